@@ -0,0 +1,82 @@
+# Throughput of the pixel export kernels used by img.toarray() and
+#   img.getpixels().  Every kernel the CPU supports is timed on the same
+#   RGB, RGBA and CMYK images and the output rate is reported in GB/s.
+#   Palette ingest (magick.image((indexes, palette))) is reported in
+#   megapixels per second for several magick.workers() settings.
+#
+#   python benchmark.py [rows columns repeat]
+
+import sys
+import time
+import magick
+import Numeric
+
+KERNELS = ('scalar', 'ssse3', 'avx2')
+WORKERS = (1, 2, 4, 8)
+
+def make_images(rows, cols):
+    rgb = Numeric.zeros((rows, cols, 3), 'b')
+    rgb[:,:,0] = (Numeric.arange(cols) % 256).astype('b')
+    rgb[:,:,1] = 128
+    rgba = Numeric.zeros((rows, cols, 4), 'b')
+    rgba[:,:,:3] = rgb
+    rgba[:,:,3] = 255
+    return [('RGB', magick.image(rgb)),
+            ('RGBA', magick.image(rgba)),
+            ('CMYK', magick.image(rgba, colorspace='CMYK'))]
+
+def best_time(func, repeat):
+    best = None
+    for i in range(repeat):
+        start = time.time()
+        out = func()
+        elapsed = time.time() - start
+        if best is None or elapsed < best:
+            best = elapsed
+    return best, len(out.tostring())
+
+def run(rows=4000, cols=4000, repeat=5):
+    default = magick.pixelkernel()
+    images = make_images(rows, cols)
+    print "%d x %d pixels, quantum = %d bytes, best of %d" % \
+          (cols, rows, magick.quantum, repeat)
+    print "%-8s %-6s %-10s %8s" % ('kernel', 'layout', 'path', 'GB/s')
+    for kernel in KERNELS:
+        try:
+            magick.pixelkernel(kernel)
+        except magick.error:
+            print "%-8s (not supported on this machine)" % kernel
+            continue
+        for layout, img in images:
+            paths = [('toarray', img.toarray),
+                     ('getpixels',
+                      lambda: img.getpixels(0, 0, cols, rows))]
+            for name, func in paths:
+                elapsed, nbytes = best_time(func, repeat)
+                print "%-8s %-6s %-10s %8.2f" % \
+                      (kernel, layout, name, nbytes / elapsed / 1e9)
+    magick.pixelkernel(default)
+    palette_ingest(rows, cols, repeat)
+
+def palette_ingest(rows, cols, repeat):
+    palette = Numeric.zeros((256, 3), 'b')
+    palette[:,0] = Numeric.arange(256).astype('b')
+    indexes = Numeric.reshape((Numeric.arange(rows*cols) % 256).astype('b'),
+                              (rows, cols))
+    default = magick.workers()
+    for workers in WORKERS:
+        magick.workers(workers)
+        best = None
+        for i in range(repeat):
+            start = time.time()
+            magick.image((indexes, palette))
+            elapsed = time.time() - start
+            if best is None or elapsed < best:
+                best = elapsed
+        print "%-8s %-6s %-10s %8.1f Mpixel/s" % \
+              ('palette', 'P8', 'image/%d' % workers, rows * cols / best / 1e6)
+    magick.workers(default)
+
+if __name__ == "__main__":
+    args = [int(x) for x in sys.argv[1:4]]
+    run(*args)
@@ -0,0 +1,255 @@
+# Service workload replay.  A fixed schedule of requests is drawn from a
+#   mix of request kinds over the JPEG, PNG, GIF, TIFF and PNM files in
+#   testimages/ and replayed by 1..64 threads or processes.  Each request
+#   decodes a file, scales it, optionally sharpens and annotates it and
+#   encodes the result in memory.  For every mode and concurrency the
+#   p50/p95/p99 latency, throughput and memory high-water mark are
+#   reported, and the whole run can be written as JSON to compare a
+#   change (interpreter lock release, caching, ...) against a baseline.
+#
+#   python benchreplay.py [options]
+#
+#     -m MIX         request kinds and weights (default: see MIX)
+#     -c LEVELS      concurrency levels, e.g. 1,4,16,64
+#     -n REQUESTS    requests per run (default 256)
+#     -p MODES       threads, processes or both (default: threads,processes)
+#     -s SEED        seed of the schedule (default 1)
+#     --cache BYTES  enable magick.imagecache(BYTES) in every worker
+#     -d DIR         directory of input images (default testimages)
+#     -o FILE        write the JSON results to FILE
+#
+#   The schedule only depends on the mix, the number of requests, the
+#   seed and the input files, so two runs with the same options replay
+#   the same traffic.  Each run happens in a forked process; the memory
+#   figure is its peak RSS (threads) or the largest and the summed peak
+#   RSS of the worker processes (processes).
+
+import os
+import glob
+import math
+import time
+import random
+import optparse
+import threading
+import Queue
+import resource
+import magick
+
+# json, or the small encoder benchsuite.py falls back on without it
+from benchsuite import dumps
+
+INPUTS = ('*.jpg', '*.png', '*.gif', '*.gif87', '*.tiff', '*.pbm', '*.pgm',
+          '*.ppm')
+
+# kind -> steps.  ('thumbnail', rows, columns) and ('resize', fraction)
+#   scale, ('sharpen', sigma) and ('annotate', text) are optional and
+#   ('encode', format) ends every request.
+KINDS = {
+    'thumb': (('thumbnail', 128, -1), ('sharpen', 0.5), ('encode', 'JPEG')),
+    'preview': (('resize', 0.5), ('sharpen', 1.0), ('annotate', 'preview'),
+                ('encode', 'JPEG')),
+    'web': (('thumbnail', 640, -1), ('annotate', 'sample'),
+            ('encode', 'PNG')),
+    'archive': (('resize', 1.0), ('encode', 'TIFF')),
+}
+
+MIX = 'thumb=6,preview=2,web=1,archive=1'
+
+def parse_mix(mix):
+    kinds = []
+    for item in mix.split(','):
+        name, weight = item.split('=')
+        if not KINDS.has_key(name):
+            raise ValueError("unknown request kind '%s'" % name)
+        kinds.append((name, int(weight)))
+    return kinds
+
+def schedule(kinds, paths, count, seed):
+    """Fixed list of (kind, path) requests."""
+    rng = random.Random(seed)
+    table = []
+    for name, weight in kinds:
+        table.extend([name] * weight)
+    return [(rng.choice(table), rng.choice(paths)) for i in range(count)]
+
+def serve(kind, path):
+    """Handle one request; returns the encoded size."""
+    img = magick.image(path)
+    for step in KINDS[kind]:
+        op = step[0]
+        if op == 'thumbnail':
+            img = magick.thumbnail(img, (step[1], step[2]))
+        elif op == 'resize':
+            shape = (int(img.rows * step[1]) or 1,
+                     int(img.columns * step[1]) or 1)
+            img = magick.resize(img, shape)
+        elif op == 'sharpen':
+            img = magick.sharpen(img, step[1])
+        elif op == 'annotate':
+            img.annotate(magick.newdc(), 4, img.rows - 4, step[1])
+        elif op == 'encode':
+            return len(img.tobytes(step[1]))
+
+def replay(requests):
+    """Serve requests in order; returns (latencies, errors)."""
+    latencies = []
+    errors = 0
+    for kind, path in requests:
+        start = time.time()
+        try:
+            serve(kind, path)
+        except magick.error:
+            errors = errors + 1
+            continue
+        latencies.append(time.time() - start)
+    return latencies, errors
+
+def run_threads(requests, n):
+    queue = Queue.Queue()
+    for req in requests:
+        queue.put(req)
+    latencies = []
+    errors = [0]
+    lock = threading.Lock()
+
+    def worker():
+        while 1:
+            try:
+                req = queue.get_nowait()
+            except Queue.Empty:
+                return
+            lat, err = replay([req])
+            lock.acquire()
+            latencies.extend(lat)
+            errors[0] = errors[0] + err
+            lock.release()
+
+    threads = [threading.Thread(target=worker) for i in range(n)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+    peak = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    return latencies, errors[0], elapsed, peak, peak
+
+def run_processes(requests, n):
+    children = []
+    start = time.time()
+    for i in range(n):
+        rd, wr = os.pipe()
+        pid = os.fork()
+        if pid == 0:
+            os.close(rd)
+            os.write(wr, repr(replay(requests[i::n])))
+            os._exit(0)
+        os.close(wr)
+        children.append((pid, rd))
+    latencies = []
+    errors = 0
+    peak = total = 0
+    for pid, rd in children:
+        data = ''
+        while 1:
+            chunk = os.read(rd, 65536)
+            if not chunk:
+                break
+            data = data + chunk
+        os.close(rd)
+        pid, status, usage = os.wait4(pid, 0)
+        if data:
+            lat, err = eval(data)
+            latencies.extend(lat)
+            errors = errors + err
+        peak = max(peak, usage.ru_maxrss)
+        total = total + usage.ru_maxrss
+    elapsed = time.time() - start
+    return latencies, errors, elapsed, peak, total
+
+def percentile(values, p):
+    """Nearest-rank percentile of sorted values."""
+    if not values:
+        return 0.0
+    k = int(math.ceil(p / 100.0 * len(values))) - 1
+    return values[max(0, min(k, len(values) - 1))]
+
+def trial(mode, requests, n, cache):
+    """One run in a forked process, so memory figures start fresh."""
+    rd, wr = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(rd)
+        if cache:
+            magick.imagecache(cache)
+        if mode == 'threads':
+            result = run_threads(requests, n)
+        else:
+            result = run_processes(requests, n)
+        os.write(wr, repr(result))
+        os._exit(0)
+    os.close(wr)
+    data = ''
+    while 1:
+        chunk = os.read(rd, 65536)
+        if not chunk:
+            break
+        data = data + chunk
+    os.close(rd)
+    os.waitpid(pid, 0)
+    latencies, errors, elapsed, peak, total = eval(data)
+    latencies.sort()
+    return {'mode': mode, 'concurrency': n, 'requests': len(requests),
+            'errors': errors, 'seconds': elapsed,
+            'throughput': len(latencies) / elapsed,
+            'p50_ms': percentile(latencies, 50) * 1e3,
+            'p95_ms': percentile(latencies, 95) * 1e3,
+            'p99_ms': percentile(latencies, 99) * 1e3,
+            'max_rss_kb': peak, 'total_rss_kb': total}
+
+def main():
+    parser = optparse.OptionParser(usage='python benchreplay.py [options]')
+    parser.add_option('-m', dest='mix', default=MIX)
+    parser.add_option('-c', dest='levels', default='1,2,4,8,16,32,64')
+    parser.add_option('-n', dest='count', type='int', default=256)
+    parser.add_option('-p', dest='modes', default='threads,processes')
+    parser.add_option('-s', dest='seed', type='int', default=1)
+    parser.add_option('--cache', dest='cache', type='int', default=0)
+    parser.add_option('-d', dest='directory', default='testimages')
+    parser.add_option('-o', dest='output', default=None)
+    opts, args = parser.parse_args()
+
+    paths = []
+    for pattern in INPUTS:
+        paths.extend(glob.glob(os.path.join(opts.directory, pattern)))
+    paths.sort()
+    if not paths:
+        parser.error('no input images in %s' % opts.directory)
+    kinds = parse_mix(opts.mix)
+    requests = schedule(kinds, paths, opts.count, opts.seed)
+    levels = [int(x) for x in opts.levels.split(',')]
+
+    print "%d requests over %d files, mix %s, workers %d, frameworkers %d" % \
+          (len(requests), len(paths), opts.mix, magick.workers(),
+           magick.frameworkers())
+    print "%-9s %4s %9s %9s %9s %9s %10s %6s" % \
+          ('mode', 'n', 'req/s', 'p50 ms', 'p95 ms', 'p99 ms', 'rss kB',
+           'errors')
+    results = []
+    for mode in opts.modes.split(','):
+        for n in levels:
+            r = trial(mode, requests, n, opts.cache)
+            print "%-9s %4d %9.1f %9.1f %9.1f %9.1f %10d %6d" % \
+                  (mode, n, r['throughput'], r['p50_ms'], r['p95_ms'],
+                   r['p99_ms'], r['total_rss_kb'], r['errors'])
+            results.append(r)
+    if opts.output:
+        f = open(opts.output, 'w')
+        f.write(dumps({'mix': opts.mix, 'seed': opts.seed,
+                       'cache': opts.cache, 'inputs': paths,
+                       'quantum': magick.quantum, 'results': results}))
+        f.write('\n')
+        f.close()
+
+if __name__ == "__main__":
+    main()
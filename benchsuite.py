@@ -0,0 +1,392 @@
+# Benchmark of every function exported by the magick module and every
+#   image method, over the testimages/ corpus and synthetic images of a
+#   few sizes.  For each function and image it reports operations per
+#   second, megabytes of input pixels per second and the peak resident
+#   set size of the process that ran it, and writes the results as JSON
+#   so runs from different releases can be compared.
+#
+#   python benchsuite.py [options]
+#
+#     -o FILE        write the JSON results to FILE (default: stdout)
+#     -s SIZES       synthetic image sizes, e.g. 256,1024,4096
+#     -c GLOB        corpus files to use (default: testimages/*)
+#     -n NAMES       only run these functions (comma separated)
+#     -t SECONDS     minimum time spent on each function and image
+#     --no-fork      run in-process (no per-function peak RSS)
+#
+#   Each function runs in a child process so that its peak RSS is its
+#   own; rss_delta_kb is the growth over the RSS inherited from the
+#   parent.  Functions that fail on an image (e.g. getindexes on a
+#   DirectClass image) are reported with an "error" entry.
+
+import sys
+import os
+import glob
+import time
+import tempfile
+import optparse
+import magick
+import Numeric
+
+try:
+    import resource
+except ImportError:
+    resource = None
+
+try:
+    import json
+    dumps = json.dumps
+except ImportError:
+    def dumps(obj, indent=None):
+        if isinstance(obj, dict):
+            items = obj.items()
+            items.sort()
+            return '{%s}' % ', '.join(['%s: %s' % (dumps(str(k)), dumps(v))
+                                       for k, v in items])
+        if isinstance(obj, (list, tuple)):
+            return '[%s]' % ', '.join([dumps(x) for x in obj])
+        if isinstance(obj, str):
+            return '"%s"' % obj.replace('\\', '\\\\').replace('"', '\\"')
+        if obj is None:
+            return 'null'
+        if obj is True or obj is False:
+            return str(obj).lower()
+        return repr(obj)
+
+# Functions that need an X display are not timed
+SKIP = ('display', 'animate')
+
+class Context:
+    """Everything a case may need for one input image."""
+    def __init__(self, img, path, tmpdir):
+        self.img = img
+        self.path = path
+        self.tmpdir = tmpdir
+        self.rows = img.rows
+        self.cols = img.columns
+        self.seq = img + img
+        self.array = img.toarray()
+        self.pixels = img.getpixels(0, 0, self.cols, self.rows)
+        n = 1000
+        self.xs = Numeric.arange(n) * 7 % self.cols
+        self.ys = Numeric.arange(n) * 13 % self.rows
+        self.colors = img.pixels_at(self.xs, self.ys)
+        self.kernel = Numeric.ones((3, 3), 'd') / 9.0
+        self.dc = magick.newdc()
+        self.prims = 'fill red rectangle 2,2 %d,%d fill blue circle ' \
+                     '%d,%d %d,%d' % (self.cols/2, self.rows/2, self.cols/2,
+                                      self.rows/2, self.cols/2,
+                                      self.rows/2 + self.rows/4)
+        self.out = os.path.join(tmpdir, 'out.miff')
+        self.pnm = os.path.join(tmpdir, 'out.pam')
+        self.null = open(os.devnull, 'w')
+        try:
+            self.indexes = img.getindexes(0, 0, self.cols, self.rows)
+        except magick.error:
+            self.indexes = None
+
+    def copy(self):
+        return self.img.copy()
+
+# name -> (setup, run).  setup(ctx) is not timed; its result is passed to
+#   run.  Module functions and image methods share one table; image
+#   methods that change the image work on a copy made by setup.
+def same(ctx):
+    return ctx
+
+def fresh(ctx):
+    return ctx.copy()
+
+def half(c):
+    return (c.rows/2 or 1, c.cols/2 or 1)
+
+CASES = {
+    # module functions
+    'image': (same, lambda c: magick.image(c.array)),
+    'stream': (same, lambda c: magick.stream(c.path, c.pnm,
+                                             (('gamma', 1.2),))),
+    'ping': (same, lambda c: magick.ping([c.path])),
+    'lazy': (same, lambda c: magick.lazy(c.img).then('gamma', 1.2).run()),
+    'newdc': (same, lambda c: magick.newdc()),
+    'average': (same, lambda c: magick.average(c.seq)),
+    'append': (same, lambda c: magick.append(c.seq)),
+    'magnify': (same, lambda c: magick.magnify(c.img)),
+    'minify': (same, lambda c: magick.minify(c.img)),
+    'resize': (same, lambda c: magick.resize(c.img, half(c))),
+    'sample': (same, lambda c: magick.sample(c.img, half(c))),
+    'scale': (same, lambda c: magick.scale(c.img, half(c))),
+    'thumbnail': (same, lambda c: magick.thumbnail(c.img, (64, -1))),
+    'chop': (same, lambda c: magick.chop(c.img, (0, c.cols/4, 0, c.rows/4))),
+    'crop': (same, lambda c: magick.crop(c.img, (0, c.cols/2, 0, c.rows/2))),
+    'coalesce': (same, lambda c: magick.coalesce(c.seq)),
+    'deconstruct': (same, lambda c: magick.deconstruct(c.seq)),
+    'flatten': (same, lambda c: magick.flatten(c.seq)),
+    'flip': (same, lambda c: magick.flip(c.img)),
+    'flop': (same, lambda c: magick.flop(c.img)),
+    'mosaic': (same, lambda c: magick.mosaic(c.seq)),
+    'roll': (same, lambda c: magick.roll(c.img, (c.cols/3, c.rows/3))),
+    'shave': (same, lambda c: magick.shave(c.img, (1, 1))),
+    'affine': (same, lambda c: magick.affine(c.img, (1, 0.2, 0.1, 1))),
+    'rotate': (same, lambda c: magick.rotate(c.img, 30)),
+    'shear': (same, lambda c: magick.shear(c.img, 10, 5)),
+    'lat': (same, lambda c: magick.lat(c.img)),
+    'addnoise': (same, lambda c: magick.addnoise(c.img, 'gaussian')),
+    'blur': (same, lambda c: magick.blur(c.img, 1.5)),
+    'despeckle': (same, lambda c: magick.despeckle(c.img)),
+    'edge': (same, lambda c: magick.edge(c.img)),
+    'emboss': (same, lambda c: magick.emboss(c.img, 1.0)),
+    'enhance': (same, lambda c: magick.enhance(c.img)),
+    'medianfilter': (same, lambda c: magick.medianfilter(c.img, 1.0)),
+    'motionblur': (same, lambda c: magick.motionblur(c.img, 2.0, 30.0)),
+    'reducenoise': (same, lambda c: magick.reducenoise(c.img)),
+    'shade': (same, lambda c: magick.shade(c.img)),
+    'sharpen': (same, lambda c: magick.sharpen(c.img, 1.0)),
+    'spread': (same, lambda c: magick.spread(c.img, 3)),
+    'unsharpmask': (same, lambda c: magick.unsharpmask(c.img, 1.0)),
+    'charcoal': (same, lambda c: magick.charcoal(c.img)),
+    'colorize': (same, lambda c: magick.colorize(c.img, 'red', 30, 30, 30)),
+    'convolve': (same, lambda c: magick.convolve(c.img, c.kernel)),
+    'implode': (same, lambda c: magick.implode(c.img)),
+    'morph': (same, lambda c: magick.morph(c.seq, 2)),
+    'oilpaint': (same, lambda c: magick.oilpaint(c.img)),
+    'stegano': (same, lambda c: magick.stegano(c.img, c.img)),
+    'stereo': (same, lambda c: magick.stereo(c.img, c.img)),
+    'swirl': (same, lambda c: magick.swirl(c.img, 90)),
+    'wave': (same, lambda c: magick.wave(c.img)),
+    'border': (same, lambda c: magick.border(c.img, 4, 4)),
+    'frame': (same, lambda c: magick.frame(c.img, 8, 8, 2, 2)),
+    'listcolors': (same, lambda c: magick.listcolors(c.null)),
+    'name2color': (same, lambda c: magick.name2color('salmon')),
+    'color2name': (same, lambda c: magick.color2name((255, 0, 0))),
+    'pixelkernel': (same, lambda c: magick.pixelkernel()),
+    'workers': (same, lambda c: magick.workers()),
+    'frameworkers': (same, lambda c: magick.frameworkers()),
+    'imagecache': (same, lambda c: magick.imagecache()),
+    'stats': (same, lambda c: magick.stats()),
+    # image methods
+    'write': (same, lambda c: c.img.write(c.out)),
+    'tobytes': (same, lambda c: c.img.tobytes('MIFF')),
+    'quantize': (fresh, lambda im: im.quantize(64)),
+    'segment': (fresh, lambda im: im.segment()),
+    'compresscolormap': (fresh, lambda im: im.compresscolormap()),
+    'copy': (same, lambda c: c.img.copy()),
+    'ordered_dither': (fresh, lambda im: im.ordered_dither()),
+    'set': (fresh, lambda im: im.set()),
+    'describe': (same, lambda c: c.img.describe(0, c.null)),
+    'diff': (same, lambda c: c.img.diff(c.img)),
+    'map': (fresh, lambda im: im.map(im)),
+    'channel': (fresh, lambda im: im.channel('red')),
+    'cyclecolor': (fresh, lambda im: im.cyclecolor(3)),
+    'setopacity': (fresh, lambda im: im.setopacity(128)),
+    'plasma': (fresh, lambda im: im.plasma((0, 0, im.columns-1, im.rows-1),
+                                           2, 2)),
+    'clip': (fresh, lambda im: im.clip()),
+    'toarray': (same, lambda c: c.img.toarray()),
+    'contrast': (fresh, lambda im: im.contrast()),
+    'equalize': (fresh, lambda im: im.equalize()),
+    'gamma': (fresh, lambda im: im.gamma(1.2)),
+    'level': (fresh, lambda im: im.level(0.0, 1.2)),
+    'levelchannel': (fresh, lambda im: im.levelchannel('red', 0.0, 1.2)),
+    'modulate': (fresh, lambda im: im.modulate(110.0)),
+    'negate': (fresh, lambda im: im.negate()),
+    'normalize': (fresh, lambda im: im.normalize()),
+    'threshold': (fresh, lambda im: im.threshold(0.5)),
+    'solarize': (fresh, lambda im: im.solarize()),
+    'raise_': (fresh, lambda im: im.raise_()),
+    'draw': (lambda c: (c.copy(), c.prims), lambda a: a[0].draw(a[1])),
+    'clip_path': (lambda c: (c.copy(), c.prims),
+                  lambda a: a[0].clip_path(a[1])),
+    'annotate': (lambda c: (c.copy(), c.dc),
+                 lambda a: a[0].annotate(a[1], 10, 20, 'benchmark')),
+    'get_type_metrics': (same, lambda c: c.img.get_type_metrics(c.dc,
+                                                               'benchmark')),
+    'colorfloodfill': (fresh, lambda im: im.colorfloodfill(im.pixel(0, 0),
+                                                           'red', 0, 0)),
+    'mattefloodfill': (fresh, lambda im: im.mattefloodfill(im.pixel(0, 0),
+                                                           128, 0, 0)),
+    'opaque': (fresh, lambda im: im.opaque(im.pixel(0, 0), 'red')),
+    'transparent': (fresh, lambda im: im.transparent(im.pixel(0, 0), 128)),
+    'drawaffine': (lambda c: (c.copy(), c.img),
+                   lambda a: a[0].drawaffine(a[1], (0.5, 0, 0, 0.5))),
+    'composite': (lambda c: (c.copy(), c.img),
+                  lambda a: a[0].composite(a[1], 4, 4)),
+    'index': (same, lambda c: c.img.index(c.cols/2, c.rows/2)),
+    'pixel': (same, lambda c: c.img.pixel(c.cols/2, c.rows/2)),
+    'getpixels': (same, lambda c: c.img.getpixels(0, 0, c.cols, c.rows)),
+    'setpixels': (lambda c: (c.copy(), c.pixels),
+                  lambda a: a[0].setpixels(a[1])),
+    'getindexes': (same, lambda c: c.img.getindexes(0, 0, c.cols, c.rows)),
+    'setindexes': (lambda c: (c.copy(), c.indexes),
+                   lambda a: a[0].setindexes(a[1])),
+    'pixels_at': (same, lambda c: c.img.pixels_at(c.xs, c.ys)),
+    'set_pixels_at': (lambda c: (c.copy(), c),
+                      lambda a: a[0].set_pixels_at(a[1].xs, a[1].ys,
+                                                   a[1].colors)),
+    'view': (same, lambda c: c.img.view()),
+}
+
+def exported():
+    """Names of the module functions and image methods."""
+    img = magick.image(Numeric.zeros((4, 4, 3), 'b'))
+    names = [n for n in img.__methods__]
+    for n in dir(magick):
+        if type(getattr(magick, n)) is type(magick.image):
+            names.append(n)
+    return names
+
+def rss_kb():
+    if resource is None:
+        return 0
+    return resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+
+def time_case(ctx, name, mintime):
+    """Run one case for at least mintime seconds."""
+    setup, run = CASES[name]
+    calls = 0
+    total = 0.0
+    best = None
+    while calls == 0 or total < mintime:
+        arg = setup(ctx)
+        start = time.time()
+        run(arg)
+        elapsed = time.time() - start
+        total = total + elapsed
+        calls = calls + 1
+        if best is None or elapsed < best:
+            best = elapsed
+    return calls, total, best
+
+def measure(ctx, name, mintime, fork):
+    """Time one case, in a child process if fork is true."""
+    if not fork:
+        base = rss_kb()
+        try:
+            calls, total, best = time_case(ctx, name, mintime)
+        except Exception, e:
+            return {'error': str(e)}
+        peak = rss_kb()
+        return {'calls': calls, 'seconds': total, 'best': best,
+                'peak_rss_kb': peak, 'rss_delta_kb': peak - base}
+    rd, wr = os.pipe()
+    pid = os.fork()
+    if pid == 0:
+        os.close(rd)
+        base = rss_kb()
+        try:
+            result = time_case(ctx, name, mintime) + (base,)
+        except Exception, e:
+            result = str(e)
+        os.write(wr, repr(result))
+        os._exit(0)
+    os.close(wr)
+    data = ''
+    while 1:
+        chunk = os.read(rd, 4096)
+        if not chunk:
+            break
+        data = data + chunk
+    os.close(rd)
+    pid, status, usage = os.wait4(pid, 0)
+    if not data:
+        return {'error': 'child exited with status %d' % status}
+    result = eval(data)
+    if isinstance(result, str):
+        return {'error': result}
+    calls, total, best, base = result
+    return {'calls': calls, 'seconds': total, 'best': best,
+            'peak_rss_kb': usage.ru_maxrss,
+            'rss_delta_kb': usage.ru_maxrss - base}
+
+def synthetic(size):
+    a = Numeric.zeros((size, size, 3), 'b')
+    a[:,:,0] = (Numeric.arange(size) % 256).astype('b')
+    a[:,:,1] = Numeric.reshape((Numeric.arange(size) % 256).astype('b'),
+                               (size, 1))
+    a[:,:,2] = 128
+    return magick.image(a)
+
+def inputs(sizes, pattern, tmpdir):
+    """(label, image, path) for the synthetic images and the corpus."""
+    result = []
+    for size in sizes:
+        img = synthetic(size)
+        path = os.path.join(tmpdir, 'synthetic_%d.miff' % size)
+        img.write(path)
+        result.append(('synthetic_%d' % size, img, path))
+    paths = glob.glob(pattern)
+    paths.sort()
+    for path in paths:
+        try:
+            img = magick.image(path)
+        except magick.error:
+            continue
+        result.append((os.path.basename(path), img, path))
+    return result
+
+def run(opts):
+    names = CASES.keys()
+    names.sort()
+    if opts.names:
+        names = [n for n in names if n in opts.names.split(',')]
+    sizes = [int(x) for x in opts.sizes.split(',') if x]
+    fork = opts.fork and hasattr(os, 'fork') and hasattr(os, 'wait4')
+    tmpdir = tempfile.mkdtemp()
+    uncovered = [n for n in exported() if n not in CASES and n not in SKIP]
+    for n in uncovered:
+        sys.stderr.write('warning: %s is not benchmarked\n' % n)
+    results = []
+    for label, img, path in inputs(sizes, opts.corpus, tmpdir):
+        try:
+            ctx = Context(img, path, tmpdir)
+        except magick.error, e:
+            sys.stderr.write('%-18s %-24s error: %s\n' % ('-', label, e))
+            continue
+        frames = len(img)
+        nbytes = ctx.rows * ctx.cols * frames * 4 * magick.quantum
+        for name in names:
+            entry = {'function': name, 'image': label, 'rows': ctx.rows,
+                     'columns': ctx.cols, 'frames': frames}
+            entry.update(measure(ctx, name, opts.mintime, fork))
+            if entry.has_key('error'):
+                sys.stderr.write('%-18s %-24s error: %s\n' %
+                                 (name, label, entry['error']))
+            else:
+                ops = entry['calls'] / entry['seconds']
+                entry['ops_per_sec'] = ops
+                entry['mb_per_sec'] = ops * nbytes / 1e6
+                sys.stderr.write('%-18s %-24s %10.1f ops/s %9.1f MB/s '
+                                 '%8d kB\n' % (name, label, ops,
+                                               entry['mb_per_sec'],
+                                               entry['peak_rss_kb']))
+            results.append(entry)
+        ctx.null.close()
+    for name in os.listdir(tmpdir):
+        os.remove(os.path.join(tmpdir, name))
+    os.rmdir(tmpdir)
+    return {'quantum': magick.quantum, 'workers': magick.workers(),
+            'frameworkers': magick.frameworkers(),
+            'pixelkernel': magick.pixelkernel(), 'mintime': opts.mintime,
+            'forked': fork, 'skipped': list(SKIP), 'uncovered': uncovered,
+            'results': results}
+
+def main():
+    parser = optparse.OptionParser(usage='python benchsuite.py [options]')
+    parser.add_option('-o', dest='output', default=None)
+    parser.add_option('-s', dest='sizes', default='256,1024,4096')
+    parser.add_option('-c', dest='corpus',
+                      default=os.path.join('testimages', '*'))
+    parser.add_option('-n', dest='names', default=None)
+    parser.add_option('-t', dest='mintime', type='float', default=0.2)
+    parser.add_option('--no-fork', dest='fork', action='store_false',
+                      default=True)
+    opts, args = parser.parse_args()
+    report = dumps(run(opts), indent=1)
+    if opts.output:
+        f = open(opts.output, 'w')
+        f.write(report + '\n')
+        f.close()
+    else:
+        print report
+
+if __name__ == "__main__":
+    main()
@@ -8,7 +8,10 @@
  */
 
 #include <Python.h>
-#include <setjmp.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <pythread.h>
 #include <Numeric/arrayobject.h>
 #include <magick/api.h>
 
@@ -31,9 +34,10 @@
 
 
 static PyObject *PyMagickError;
-static jmp_buf error_jmp;
 static int ptype;
 static size_t _qsize;
+static int _rgbstride;      /* byte step red->green->blue in a PixelPacket */
+static char _pixelorder[5]; /* channel order of a PixelPacket in memory */
 
 #if !defined(DegreesToRadians)
 #define DegreesToRadians(x) ((x)*3.14159265358979323846/180.0)
@@ -65,7 +69,9 @@ static size_t _qsize;
                 return STR2PYSTR((str)[(val)]); \
             ERRMSG4((attr), (val))
 
-static ExceptionInfo exception;
+/* There is no shared exception state.  Every wrapper owns an ExceptionInfo
+   (named exception, so CHECK_ERR can find it) and ERR converts it to
+   magick.error, then resets it so it can be reused within the call. */
 #define PyMagickErr(exc)       ((exc).severity != UndefinedException)
 #define ERR(exc) {              \
     if ((exc).severity < ErrorException) {      \
@@ -75,7 +81,8 @@ static ExceptionInfo exception;
             ((exc).description ? " (" : ""),        \
             ((exc).description ? (exc).description : ""),   \
             ((exc).description ? ")" : ""));            \
-        SetExceptionInfo(&(exc),UndefinedException);        \
+        DestroyExceptionInfo(&(exc));       \
+        GetExceptionInfo(&(exc));           \
     }                                   \
     else {                              \
         PyErr_Format( PyMagickError,                \
@@ -85,7 +92,8 @@ static ExceptionInfo exception;
               ((exc).description ? " (" : ""),      \
               ((exc).description ? (exc).description : ""), \
               ((exc).description ? ")" : ""));      \
-        SetExceptionInfo(&(exc),UndefinedException);        \
+        DestroyExceptionInfo(&(exc));       \
+        GetExceptionInfo(&(exc));           \
         goto fail; \
     }              \
 }
@@ -93,6 +101,26 @@ static ExceptionInfo exception;
 #define CHECK_ERR  if PyMagickErr(exception) ERR(exception)
 #define CHECK_ERR_IM(im)  if PyMagickErr((im)->exception) ERR((im)->exception)
 
+/* Module-level filters run GraphicsMagick with the interpreter lock
+   released.  The loop over frames stops at the first error and the
+   exception is converted once the lock is held again.  Each frame
+   reports to its own ExceptionInfo, folded in with keep_exception(), so
+   a warning from an early frame is not overwritten by a later one. */
+#define MAGICK_FAILED(exc)  ((exc).severity >= ErrorException)
+#define CHECK_EXC(exc)  if PyMagickErr(exc) ERR(exc)
+
+/* Fold the exception of one frame into exception: an error always
+   wins, a warning only if nothing was reported before it. */
+static void
+keep_exception(ExceptionInfo *exception, const ExceptionInfo *frame)
+{
+    if (MAGICK_FAILED(*frame) ||
+        ((frame->severity != UndefinedException) &&
+         (exception->severity == UndefinedException)))
+        ThrowException(exception, frame->severity, frame->reason, 
+                       frame->description);
+}
+
 #define ThrowImage2Exception(severity,tag,context)  \
 { \
   (void) ThrowException(exception, severity,tag, context);\
@@ -104,6 +132,33 @@ static ExceptionInfo exception;
 
 staticforward PyTypeObject MImage_Type;
 staticforward PyTypeObject DrawInfo_Type;
+staticforward PyTypeObject Blob_Type;
+staticforward PyTypeObject Drawing_Type;
+
+/* Encoded image data, see the BlobObject section */
+typedef struct {
+    PyObject_HEAD
+    void *data;
+    size_t length;
+} PyBlobObject;
+
+#define ASBLOB(b) ((PyBlobObject *)(b))
+
+/* Compiled drawing, see the DrawingObject section */
+#define DRAWING_SIZES 4
+
+typedef struct {
+    PyObject_HEAD
+    DrawInfo *info;
+    int direct;
+    Image *overlays[DRAWING_SIZES];
+} PyDrawingObject;
+
+#define ASDRAWING(d) ((PyDrawingObject *)(d))
+#define PyDrawing_Check(v)      ((v)->ob_type == &Drawing_Type)
+
+static int draw_compiled(PyObject *, Image *);
+static Image *share_frames(const Image *, long, ExceptionInfo *);
 
 #define PyMImage_Check(v)      ((v)->ob_type == &MImage_Type)
 #define PyDrawInfo_Check(v)      ((v)->ob_type == &DrawInfo_Type)
@@ -113,8 +168,80 @@ staticforward PyTypeObject DrawInfo_Type;
 typedef struct {
     PyObject_HEAD
     Image *ims;      /* Can be a single image or a linked list of images */
+    Image **frames;  /* frames[k] is frame k of ims, see mimage_frames() */
+    long nframes;    /* length of frames, or -1 if it must be rebuilt */
+    long allocframes;
 } PyMImageObject;
 
+/* New image object with an empty list.  Use this rather than
+   PyObject_New so the frame table starts out empty too. */
+static PyMImageObject *
+mimage_alloc(void)
+{
+    PyMImageObject *obj;
+
+    obj = PyObject_New(PyMImageObject, &MImage_Type);
+    if (obj == NULL) return NULL;
+    obj->ims = NULL;
+    obj->frames = NULL;
+    obj->nframes = -1;
+    obj->allocframes = 0;
+    return obj;
+}
+
+/* Code that links frames into or out of obj->ims calls this */
+#define mimage_changed(obj) ((obj)->nframes = -1)
+
+/* Frame table.  Sequence access (len, indexing, slicing, the z argument
+   of pixel methods) reads frames[] instead of walking the list, so a
+   loop over all frames is linear.  The table is rebuilt in one walk
+   after mimage_changed(), or when it no longer matches the ends of the
+   list.  Returns the number of frames, or -1 with an error set. */
+static long
+mimage_frames(PyMImageObject *obj)
+{
+    Image *im, **frames;
+    long n;
+
+    if ((obj->nframes >= 0) &&
+        ((obj->nframes == 0) ? (obj->ims == NULL) : 
+         ((obj->frames[0] == obj->ims) && 
+          (obj->frames[obj->nframes-1]->next == NULL))))
+        return obj->nframes;
+    n = 0;
+    for (im=obj->ims; im; im=im->next) {
+        if (n == obj->allocframes) {
+            frames = (Image **) PyMem_Realloc(obj->frames, 
+                                  (2*n + 16)*sizeof(Image *));
+            if (frames == NULL) {
+                obj->nframes = -1;
+                PyErr_NoMemory();
+                return -1;
+            }
+            obj->frames = frames;
+            obj->allocframes = 2*n + 16;
+        }
+        obj->frames[n++] = im;
+    }
+    obj->nframes = n;
+    return n;
+}
+
+/* Frame z of obj, or NULL (without an error set) if there is none */
+static Image *
+mimage_frame(PyMImageObject *obj, long z)
+{
+    long n = mimage_frames(obj);
+
+    if ((z < 0) || (z >= n)) return NULL;
+    if ((z > 0) && (obj->frames[z-1]->next != obj->frames[z])) {
+        mimage_changed(obj);    /* relinked behind our back */
+        n = mimage_frames(obj);
+        if (z >= n) return NULL;
+    }
+    return obj->frames[z];
+}
+
 typedef struct {
     PyObject_HEAD
     DrawInfo *info;
@@ -149,10 +276,11 @@ static char
   {
       "UserSpace", "UserSpaceOnUse", "ObjectBoundingBox", (char *) NULL
   },
-  *ColorspaceTypes[] =
+  *ColorspaceTypes[] =      /* in GraphicsMagick's ColorspaceType order */
   {
-    "Undefined", "RGB", "Gray", "Transparent", "OHTA", "XYZ", "YCbCr",
-    "YCC", "YIQ", "YPbPr", "YUV", "CMYK", "sRGB", (char *) NULL
+    "Undefined", "RGB", "Gray", "Transparent", "OHTA", "XYZ", "YCC", "YIQ",
+    "YPbPr", "YUV", "CMYK", "sRGB", "HSL", "HWB", "LAB", "CineonLogRGB",
+    "Rec601Luma", "Rec601YCbCr", "Rec709Luma", "Rec709YCbCr", (char *) NULL
   }, /*
   *ComplianceTypes[] = 
   {
@@ -386,54 +514,296 @@ static int LookupStr(char **list,const char *string)
   return(offset);
 }
 
+/* Index of the colorspace called name in ColorspaceTypes, or -1.  YCbCr
+   (which GraphicsMagick defines as Rec601YCbCr) is accepted too. */
+static int
+lookup_colorspace(const char *name)
+{
+    if (strEQcase(name, "YCbCr")) name = "Rec601YCbCr";
+    return LookupStr(ColorspaceTypes, name);
+}
+
 /* Forward declarations */
 
 static int mimage_setattr(PyMImageObject *, char *, PyObject *);
 
 /*
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%   P y M a g i c k E r r o r H a n d l e r                                   %
-%                                                                             %
-%                                                                             %
-%                                                                             %
-%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
-%
-%  Method PyMagickErrorHandler replaces ImageMagick's fatal error handler.  
-%  This stores the message in a Python variable,and longjmp's to return the 
-%  error.  Note that this doesn't exit but returns control to Python; 
-%
-%  The format of the PyMagickErrorHandler routine is:
-%
-%      PyMagickErrorHandler(const ExceptionType severity,const char *reason,
-%        const char *qualifier)
-%
-%  A description of each parameter follows:
-%
-%    o severity: The severity of the exception.
-%
-%    o reason: The reason of the exception.
-%
-%    o description: The exception description.
-%
-%
+  Pixel export kernels.
+
+  deinterleave() copies n PixelPackets into n*channels Quantums in red,
+  green, blue(, opacity) order.  channels is 3 (RGB) or 4 (RGBA, or CMYK
+  with black in opacity).  The scalar kernel always works.  On x86 the
+  SSSE3 and AVX2 kernels are picked at import time when the CPU has
+  them; magick.pixelkernel() reports or overrides the choice.  The
+  vector kernels shuffle whole 16 byte blocks with a mask built from the
+  real PixelPacket layout, so they do not depend on QuantumDepth or
+  byte order.
+*/
+typedef void (*DeinterleaveFunc)(const PixelPacket *, Quantum *, long, int);
+
+static void
+deinterleave_scalar(const PixelPacket *p, Quantum *q, long n, int channels)
+{
+    register long x;
+
+    assert((channels == 3) || (channels == 4));
+    if (channels == 4) {
+        for (x=0; x < n; x++, p++) {
+            *q++ = p->red;
+            *q++ = p->green;
+            *q++ = p->blue;
+            *q++ = p->opacity;
+        }
+    }
+    else {
+        for (x=0; x < n; x++, p++) {
+            *q++ = p->red;
+            *q++ = p->green;
+            *q++ = p->blue;
+        }
+    }
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (__GNUC__ > 4) || \
+     ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+
+/* pshufb masks turning 16 bytes of PixelPackets into RGB / RGBA */
+static unsigned char _shufmask[2][16];
+
+static void
+build_shuffle_masks(void)
+{
+    size_t offset[4];
+    size_t per, j, pix, chan;
+    int channels;
+
+    offset[0] = offsetof(PixelPacket, red);
+    offset[1] = offsetof(PixelPacket, green);
+    offset[2] = offsetof(PixelPacket, blue);
+    offset[3] = offsetof(PixelPacket, opacity);
+    per = 16 / sizeof(PixelPacket);
+    for (channels=3; channels <= 4; channels++) {
+        for (j=0; j < 16; j++) {
+            pix = j / (channels*_qsize);
+            chan = (j / _qsize) % channels;
+            if (pix < per)
+                _shufmask[channels-3][j] = (unsigned char)
+                    (pix*sizeof(PixelPacket) + offset[chan] + j % _qsize);
+            else
+                _shufmask[channels-3][j] = 0x80;
+        }
+    }
+}
+
+/* For RGB each block yields 12 valid bytes but stores 16, so the loops
+   stop while at least one more block of output is still to be written. */
+__attribute__((target("ssse3")))
+static void
+deinterleave_ssse3(const PixelPacket *p, Quantum *q, long n, int channels)
+{
+    __m128i mask, v;
+    long per, x = 0, tail;
+    char *dst = (char *) q;
+    size_t outb;
+
+    assert((channels == 3) || (channels == 4));
+    per = 16 / sizeof(PixelPacket);
+    outb = per*channels*_qsize;
+    tail = (channels == 4) ? per : 2*per;
+    mask = _mm_loadu_si128((const __m128i *) _shufmask[channels-3]);
+    for ( ; x + tail <= n; x += per) {
+        v = _mm_loadu_si128((const __m128i *) (p + x));
+        _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(v, mask));
+        dst += outb;
+    }
+    deinterleave_scalar(p + x, (Quantum *) dst, n - x, channels);
+}
+
+__attribute__((target("avx2")))
+static void
+deinterleave_avx2(const PixelPacket *p, Quantum *q, long n, int channels)
+{
+    __m256i mask, v;
+    long per, x = 0, tail;
+    char *dst = (char *) q;
+    size_t outb;
+
+    assert((channels == 3) || (channels == 4));
+    per = 16 / sizeof(PixelPacket);
+    outb = per*channels*_qsize;
+    tail = (channels == 4) ? 2*per : 3*per;
+    mask = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) _shufmask[channels-3]));
+    for ( ; x + tail <= n; x += 2*per) {
+        v = _mm256_shuffle_epi8(
+            _mm256_loadu_si256((const __m256i *) (p + x)), mask);
+        if (channels == 4)
+            _mm256_storeu_si256((__m256i *) dst, v);
+        else {
+            _mm_storeu_si128((__m128i *) dst, _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i *) (dst + outb),
+                             _mm256_extracti128_si256(v, 1));
+        }
+        dst += 2*outb;
+    }
+    deinterleave_scalar(p + x, (Quantum *) dst, n - x, channels);
+}
+#endif
+
+static char *kernelnames[] = {"scalar", "ssse3", "avx2", NULL};
+static DeinterleaveFunc kernelfuncs[] = {
+    deinterleave_scalar,
+#ifdef HAVE_X86_KERNELS
+    deinterleave_ssse3,
+    deinterleave_avx2,
+#else
+    NULL, NULL,
+#endif
+};
+static int _kernel = 0;
+#define deinterleave (kernelfuncs[_kernel])
+
+static int
+kernel_supported(int k)
+{
+    if (k == 0) return True;
+#ifdef HAVE_X86_KERNELS
+    if ((16 % sizeof(PixelPacket)) != 0) return False;
+    __builtin_cpu_init();
+    if (k == 1) return __builtin_cpu_supports("ssse3");
+    if (k == 2) return __builtin_cpu_supports("avx2");
+#endif
+    return False;
+}
+
+
+/*
+  Row-band parallelism.
+
+  run_row_bands() splits rows [0,rows) into up to _workers bands.  It runs
+  func on each band, one thread per band, with the first band on the
+  calling thread.  It returns when every band is done.  The bands are
+  disjoint and each output element only depends on its own input, so
+  the result is identical to the serial loop.  Workers only touch plain
+  memory (never Python or the GraphicsMagick pixel cache API), and the
+  caller should release the interpreter lock around the call.
 */
-static void PyMagickErrorHandler(const ExceptionType severity,
-                 const char *reason,
-                 const char *description)
+#define MAX_WORKERS 64
+#define MIN_BAND_PIXELS 65536L
+
+typedef void (*BandFunc)(void *, long, long);
+
+typedef struct {
+    BandFunc func;
+    void *arg;
+    long first, last;
+    PyThread_type_lock done;
+} BandJob;
+
+static int _workers = 1;
+
+static void
+run_band(void *arg)
+{
+    BandJob *job = (BandJob *) arg;
+
+    job->func(job->arg, job->first, job->last);
+    PyThread_release_lock(job->done);
+}
+
+/* Split [0,count) into n contiguous bands and run them concurrently */
+static void
+run_bands(BandFunc func, void *arg, long count, long n)
+{
+    BandJob jobs[MAX_WORKERS];
+    long k;
+
+    if (n > MAX_WORKERS) n = MAX_WORKERS;
+    if (n > count) n = count;
+    if (n <= 1) {
+        func(arg, 0, count);
+        return;
+    }
+    for (k=0; k < n; k++) {
+        jobs[k].func = func;
+        jobs[k].arg = arg;
+        jobs[k].first = count*k / n;
+        jobs[k].last = count*(k+1) / n;
+        jobs[k].done = NULL;
+    }
+    for (k=1; k < n; k++) {
+        jobs[k].done = PyThread_allocate_lock();
+        if (jobs[k].done != NULL) {
+            PyThread_acquire_lock(jobs[k].done, 1);
+            if (PyThread_start_new_thread(run_band, &jobs[k]) != -1)
+                continue;
+            PyThread_release_lock(jobs[k].done);
+            PyThread_free_lock(jobs[k].done);
+            jobs[k].done = NULL;
+        }
+        func(arg, jobs[k].first, jobs[k].last);  /* no thread: run here */
+    }
+    func(arg, jobs[0].first, jobs[0].last);
+    for (k=1; k < n; k++) {
+        if (jobs[k].done == NULL) continue;
+        PyThread_acquire_lock(jobs[k].done, 1);
+        PyThread_release_lock(jobs[k].done);
+        PyThread_free_lock(jobs[k].done);
+    }
+}
+
+static void
+run_row_bands(BandFunc func, void *arg, long rows, long columns)
+{
+    long n = _workers;
+
+    if (n > (rows*columns) / MIN_BAND_PIXELS) 
+        n = (rows*columns) / MIN_BAND_PIXELS;
+    run_bands(func, arg, rows, n);
+}
+
+/* Return the whole frame as one block of pixels straight from an
+   in-memory pixel cache, or NULL if the cache cannot hand out such a
+   block (e.g. it lives on disk).  An in-memory cache returns pointers
+   into the cache itself, so row 1 starts exactly one row after row 0.
+   That is checked with two one-row requests first, so a disk or mapped
+   cache never has to read the whole frame just to be turned down.
+   Afterwards GetIndexes() refers to the whole frame. */
+static PixelPacket *
+get_frame_pixels(Image *image)
+{
+    PixelPacket *row0, *row1;
+
+    row0 = GetImagePixels(image, 0, 0, image->columns, 1);
+    if ((row0 == NULL) || (image->rows < 2)) return row0;
+    row1 = GetImagePixels(image, 0, 1, image->columns, 1);
+    if ((row1 == NULL) || (row0 + image->columns != row1)) return NULL;
+    return GetImagePixels(image, 0, 0, image->columns, image->rows);
+}
+
+/* Read-only counterpart of get_frame_pixels().  Errors are dropped:
+   callers fall back to reading row by row, which reports them. */
+static const PixelPacket *
+acquire_frame_pixels(const Image *image)
 {
-    char
-        text[MaxTextExtent];
+    const PixelPacket *row0, *row1, *pixels = NULL;
+    ExceptionInfo exception;
 
-    FormatString(text,"Exception %d: %.512s%s%.512s%s",severity,
-         reason ? reason : "ERROR",
-         description ? " (" : "", 
-                 description ? description : "",
-         description ? ")" : "");
-    PyErr_SetString(PyMagickError, text);
-    longjmp(error_jmp, (int) severity);
+    GetExceptionInfo(&exception);
+    row0 = AcquireImagePixels(image, 0, 0, image->columns, 1, &exception);
+    if ((row0 != NULL) && (image->rows < 2)) pixels = row0;
+    else if (row0 != NULL) {
+        row1 = AcquireImagePixels(image, 0, 1, image->columns, 1, 
+                                  &exception);
+        if ((row1 != NULL) && (row0 + image->columns == row1))
+            pixels = AcquireImagePixels(image, 0, 0, image->columns, 
+                                        image->rows, &exception);
+    }
+    DestroyExceptionInfo(&exception);
+    return pixels;
 }
 
 
@@ -780,10 +1150,101 @@ ConstitutePaletteColormap(Image *image, const char *colorspace,
 }
 
 
-#define ScaleCharToRange(val,N) ((Quantum) ((val) * (N) / 256UL))
-#define ScaleShortToRange(val,N) ((Quantum) ((val) * (N) / 65536UL))
-#define ScaleIntToRange(val,N) ((Quantum) (((val) != 429467295UL) ? ((val) * (N) / 4294967295UL) : N-1 ))
-#define ScaleLongToRange(val,N) ((Quantum) (((val) != 429467295UL) ? ((val) * (N) / 4294967295UL) : N-1))
+/* Map the full range of the pixel type onto [0, N-1] */
+#define ClampToRange(val,N) ((val) < (N) ? (val) : (N)-1)
+#define ScaleCharToRange(val,N) (((unsigned long) (val) * (N)) >> 8)
+#define ScaleShortToRange(val,N) (((unsigned long) (val) * (N)) >> 16)
+#define ScaleIntToRange(val,N) \
+    ClampToRange((unsigned long) ((double) (val) * (N) / 4294967295.0), N)
+#define ScaleLongToRange(val,N) ScaleIntToRange(val,N)
+#define ScaleFloatToRange(val,N) ((unsigned long) ((double) ((N)-1)*(val)))
+
+/* Pixels handed to the pixel cache per SetImagePixels request */
+#define PALETTE_BAND_PIXELS 262144L
+
+/* Scale each value to an index once, store it, and copy the whole
+   colormap entry in a single assignment. */
+#define EXPAND_PALETTE(ctype, scale) \
+{ \
+    register const ctype *p = (const ctype *) pixels; \
+    for (x=0; x < count; x++) { \
+        index=scale(p[x],N); \
+        indexes[x]=(IndexPacket) index; \
+        q[x]=colormap[index]; \
+    } \
+}
+
+static void
+expand_palette(const StorageType type, const void *pixels, PixelPacket *q,
+               IndexPacket *indexes, const PixelPacket *colormap,
+               const unsigned long N, const long count)
+{
+    register long x;
+    unsigned long index;
+
+    switch (type)
+        {
+        case CharPixel:
+            EXPAND_PALETTE(unsigned char, ScaleCharToRange);
+            break;
+        case ShortPixel:
+            EXPAND_PALETTE(unsigned short, ScaleShortToRange);
+            break;
+        case IntegerPixel:
+            EXPAND_PALETTE(unsigned int, ScaleIntToRange);
+            break;
+        case LongPixel:
+            EXPAND_PALETTE(unsigned long, ScaleLongToRange);
+            break;
+        case FloatPixel:
+            EXPAND_PALETTE(float, ScaleFloatToRange);
+            break;
+        case DoublePixel:
+            EXPAND_PALETTE(double, ScaleFloatToRange);
+            break;
+        default:
+            break;
+        }
+}
+
+/* Bytes per value of a StorageType (0 if unknown) */
+static size_t
+storage_size(const StorageType type)
+{
+    switch (type)
+        {
+        case CharPixel: return sizeof(unsigned char);
+        case ShortPixel: return sizeof(unsigned short);
+        case IntegerPixel: return sizeof(unsigned int);
+        case LongPixel: return sizeof(unsigned long);
+        case FloatPixel: return sizeof(float);
+        case DoublePixel: return sizeof(double);
+        default: return 0;
+        }
+}
+
+/* One row band of a palette frame for run_row_bands() */
+typedef struct {
+    StorageType type;
+    const char *pixels;
+    size_t size;
+    PixelPacket *q;
+    IndexPacket *indexes;
+    const PixelPacket *colormap;
+    unsigned long N;
+    long columns;
+} PaletteBand;
+
+static void
+palette_band(void *arg, long first, long last)
+{
+    PaletteBand *b = (PaletteBand *) arg;
+    long offset = first * b->columns;
+
+    expand_palette(b->type, b->pixels + offset * b->size, b->q + offset,
+                   b->indexes + offset, b->colormap, b->N,
+                   (last - first) * b->columns);
+}
 
 static Image*
 ConstitutePaletteImage(const unsigned long width, 
@@ -799,14 +1260,15 @@ ConstitutePaletteImage(const unsigned long width,
     Image
         *image;
     long
-        y, N;
+        y, band, count;
+    size_t
+        size;
+    const char
+        *p;
     PixelPacket
         *q;
-    register IndexPacket
-        *indexes;
-    
-    register long
-        x;
+    PaletteBand
+        b;
 
   /*
     Allocate image structure.
@@ -815,195 +1277,80 @@ ConstitutePaletteImage(const unsigned long width,
   assert(exception != (ExceptionInfo *) NULL);
   assert(exception->signature == MagickSignature);
   SetExceptionInfo(exception,UndefinedException);
+  size = storage_size(type);
+  if (size == 0)
+    ThrowImage2Exception(OptionError,"UnrecognizedPixelMap", colorspace);
   image=AllocateImage((ImageInfo *) NULL);
   if (image == (Image *) NULL)
     return((Image *) NULL);
   if ((width == 0) || (height == 0))
-    ThrowImage2Exception(OptionError,"UnableToConstituteImage",
-            "NonzeroWidthAndHeightRequired");
+    {
+      DestroyImage(image);
+      ThrowImage2Exception(OptionError,"UnableToConstituteImage",
+                           "NonzeroWidthAndHeightRequired");
+    }
   image->columns=width;
   image->rows=height;
 
   if (!ConstitutePaletteColormap(image,colorspace,ctype,cmap,colors))
-    ThrowImage2Exception(ResourceLimitError,"MemoryAllocationFailed",
-             "UnableToConstituteImage"); 
+    {
+      DestroyImage(image);
+      ThrowImage2Exception(ResourceLimitError,"MemoryAllocationFailed",
+                           "UnableToConstituteImage");
+    }
 
-  N = image->colors;
   /* What to do if value in pixels surpasses size of colormap?
 
      Scale the pixel value range (as defined by the type)
         to the colormap size range.  
   */
-  switch (type)
-      {
-      case CharPixel:
-          {
-              register unsigned char
-                  *p;
-              
-              p=(unsigned char *) pixels;
-              for (y=0; y < (long) image->rows; y++)
-                  {
-                      q=SetImagePixels(image,0,y,image->columns,1);
-                      if (q == (PixelPacket *) NULL)
-                          break;
-                      indexes=GetIndexes(image);
-                      for (x=0; x < (long) image->columns; x++)
-                          { 
-                              indexes[x]=ScaleCharToRange(*p++,N);
-                              q->red=image->colormap[indexes[x]].red;
-                              q->green=image->colormap[indexes[x]].green;
-                              q->blue=image->colormap[indexes[x]].blue;
-                              q->opacity=image->colormap[indexes[x]].opacity;
-                              q++;
-                          }
-                      if (!SyncImagePixels(image))
-                          break;
-                  }
-              break;
-          }
-      case ShortPixel:
-          {
-              register unsigned short
-                  *p;
-              
-              p=(unsigned short *) pixels;
-              for (y=0; y < (long) image->rows; y++)
-                  {
-                      q=SetImagePixels(image,0,y,image->columns,1);
-                      if (q == (PixelPacket *) NULL)
-                          break;
-                      indexes=GetIndexes(image);
-                      for (x=0; x < (long) image->columns; x++)
-                          {
-                              indexes[x]=ScaleShortToRange(*p++,N);
-                              q->red=image->colormap[indexes[x]].red;
-                              q->green=image->colormap[indexes[x]].green;
-                              q->blue=image->colormap[indexes[x]].blue;
-                              q->opacity=image->colormap[indexes[x]].opacity;
-                              q++;
-                          }
-                      if (!SyncImagePixels(image))
-                          break;
-                  }
-              break;
-          }
-      case IntegerPixel:
-          {
-              register unsigned int
-                  *p;
-          
-              p=(unsigned int *) pixels;
-              for (y=0; y < (long) image->rows; y++)
-                  {
-                      q=SetImagePixels(image,0,y,image->columns,1);
-                      if (q == (PixelPacket *) NULL)
-                          break;
-                      indexes=GetIndexes(image);
-                      for (x=0; x < (long) image->columns; x++)
-                          {
-                              indexes[x]=ScaleIntToRange(*p,N); p++;
-                              q->red=image->colormap[indexes[x]].red;
-                              q->green=image->colormap[indexes[x]].green;
-                              q->blue=image->colormap[indexes[x]].blue;
-                              q->opacity=image->colormap[indexes[x]].opacity;
-                              q++;
-                          }
-                      if (!SyncImagePixels(image))
-                          break;
-                  }
-              break;
-          }
-      case LongPixel:
-          {
-              register unsigned long
-                  *p;
-              
-              p=(unsigned long *) pixels;
-              for (y=0; y < (long) image->rows; y++)
-                  {
-                      q=SetImagePixels(image,0,y,image->columns,1);
-                      if (q == (PixelPacket *) NULL)
-                          break;
-                      indexes=GetIndexes(image);
-                      for (x=0; x < (long) image->columns; x++)
-                          {
-                              indexes[x]=ScaleLongToRange(*p,N); p++;
-                              q->red=image->colormap[indexes[x]].red;
-                              q->green=image->colormap[indexes[x]].green;
-                              q->blue=image->colormap[indexes[x]].blue;
-                              q->opacity=image->colormap[indexes[x]].opacity;
-                              q++;
-                          }
-                      if (!SyncImagePixels(image))
-                          break;
-                  }
-              break;
-          }
-      case FloatPixel:
-          {
-              register float
-                  *p;
-              
-              p=(float *) pixels;
-              for (y=0; y < (long) image->rows; y++)
-                  {
-                      q=SetImagePixels(image,0,y,image->columns,1);
-                      if (q == (PixelPacket *) NULL)
-                          break;
-                      indexes=GetIndexes(image);
-                      for (x=0; x < (long) image->columns; x++)
-                          {
-                              indexes[x]=(Quantum) ((float) (N-1)*(*p++));
-                              q->red=image->colormap[indexes[x]].red;
-                              q->green=image->colormap[indexes[x]].green;
-                              q->blue=image->colormap[indexes[x]].blue;
-                              q->opacity=image->colormap[indexes[x]].opacity;
-                              q++;
-                          }
-                      if (!SyncImagePixels(image))
-                          break;
-                  }
-              break;
-          }
-      case DoublePixel:
-          {
-              register double
-                  *p;
-              
-              p=(double *) pixels;
-              for (y=0; y < (long) image->rows; y++)
-                  {
-                      q=SetImagePixels(image,0,y,image->columns,1);
-                      if (q == (PixelPacket *) NULL)
-                          break;
-                      indexes=GetIndexes(image);
-                      for (x=0; x < (long) image->columns; x++)
-                          {
-                              indexes[x]=(Quantum) ((double) (N-1)*(*p++));
-                              q->red=image->colormap[indexes[x]].red;
-                              q->green=image->colormap[indexes[x]].green;
-                              q->blue=image->colormap[indexes[x]].blue;
-                              q->opacity=image->colormap[indexes[x]].opacity;
-                              q++;
-                          }
-                      if (!SyncImagePixels(image))
-                          break;
-                  }
-              break;
-          }
-      default:
-          {
-              DestroyImage(image);
-              ThrowImage2Exception(OptionError,"UnrecognizedPixelMap", colorspace)
-          }
-      }
+  b.type = type;
+  b.pixels = (const char *) pixels;
+  b.size = size;
+  b.colormap = image->colormap;
+  b.N = image->colors;
+  b.columns = (long) image->columns;
+  if ((_workers > 1) && ((b.q = get_frame_pixels(image)) != NULL))
+    {
+      /* In-memory cache: fill the whole frame in place, band per worker */
+      b.indexes = GetIndexes(image);
+      run_row_bands(palette_band, &b, (long) image->rows, b.columns);
+      y = SyncImagePixels(image) ? (long) image->rows : 0;
+    }
+  else
+    {
+      band = PALETTE_BAND_PIXELS / b.columns;
+      if (band < 1) band = 1;
+      p = b.pixels;
+      for (y=0; y < (long) image->rows; y+=band)
+        {
+          count = image->rows - y;
+          if (count > band) count = band;
+          q=SetImagePixels(image,0,y,image->columns,count);
+          if (q == (PixelPacket *) NULL)
+            break;
+          count *= b.columns;
+          expand_palette(type, p, q, GetIndexes(image), b.colormap, b.N,
+                         count);
+          p += count * size;
+          if (!SyncImagePixels(image))
+            break;
+        }
+    }
+  if (y < (long) image->rows)
+    {
+      (void) ThrowException(exception,image->exception.severity,
+                            image->exception.reason,
+                            image->exception.description);
+      DestroyImage(image);
+      return((Image *) NULL);
+    }
   return(image);
 }  
 
 
 static Image*
-convert_bitmap(PyArrayObject *arrobj)
+convert_bitmap(PyArrayObject *arrobj, ExceptionInfo *exception)
 {
     PyArrayObject *bitobj;
     unsigned char zeros[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
@@ -1025,28 +1372,17 @@ convert_bitmap(PyArrayObject *arrobj)
     }
     
     image = ConstituteImage(DIM(bitobj,1),DIM(bitobj,0),
-                            "I", CharPixel, DATA(bitobj), &exception);
-    if PyMagickErr(exception) return NULL;
+                            "I", CharPixel, DATA(bitobj), exception);
+    Py_DECREF(bitobj);
+    if PyMagickErr(*exception) return NULL;
     if (image != NULL) 
         SetImageType(image, BilevelType);
     return image;    
 }
 
 static Image*
-convert_grayscale(PyArrayObject *arrobj) 
-{
-    Image *image;
-    StorageType stype;
-
-    stype = arraytype_to_storagetype(TYPE(arrobj));
-    image = ConstituteImage(DIM(arrobj,1), DIM(arrobj,0),
-                "I", stype, DATA(arrobj),&exception);
-    if PyMagickErr(exception) return NULL;
-    return image;
-}
-
-static Image*
-convert_palette(PyArrayObject *arrobj, PyArrayObject *pal, ImageInfo *info) 
+convert_palette(PyArrayObject *arrobj, PyArrayObject *pal, ImageInfo *info,
+                ExceptionInfo *exception)
 {
 
     Image *image;
@@ -1066,74 +1402,26 @@ convert_palette(PyArrayObject *arrobj, PyArrayObject *pal, ImageInfo *info)
     stype = arraytype_to_storagetype(TYPE(arrobj));
     paltype = arraytype_to_storagetype(TYPE(pal));
 
-    image = ConstitutePaletteImage(DIM(arrobj,0), DIM(arrobj,1),
+    Py_BEGIN_ALLOW_THREADS
+    image = ConstitutePaletteImage(DIM(arrobj,1), DIM(arrobj,0),
                                    stype, DATA(arrobj),
                                    str, paltype, DATA(pal),
-                                   DIM(pal,0), &exception);
-
-    if PyMagickErr(exception) return NULL;
-    return image;
-}
+                                   DIM(pal,0), exception);
+    Py_END_ALLOW_THREADS
 
-
-static Image*
-convert_colorspace(PyArrayObject *arrobj, ImageInfo *info)
-{
-    Image *image;
-    StorageType stype;
-    char *str,
-        *str1 = "RGB",
-        *str2 = "CMYK",
-        *str3 = "RGBA";
-
-
-    if (DIM(arrobj,2) == 3) str=str1;
-    else if(info->colorspace == CMYKColorspace) str=str2;
-    else str=str3;
-    stype = arraytype_to_storagetype(TYPE(arrobj));
-    image = ConstituteImage(DIM(arrobj,1), DIM(arrobj,0),
-                            str, stype, DATA(arrobj),
-                            &exception);
-    if PyMagickErr(exception) return NULL;
+    if PyMagickErr(*exception) return NULL;
     return image;
 }
 
 
-static Image*
-convert_grayscale_sequence(PyArrayObject *arrobj, ImageInfo *info)
-{
-    int N, k, step;
-    Image *images, *image=NULL;
-    StorageType stype;
-    char *arrptr;
-
-    N = DIM(arrobj,0);  /* The number of frames to convert */
-    images = NewImageList();    
-    stype = arraytype_to_storagetype(TYPE(arrobj));
-    arrptr = DATA(arrobj);
-    step = STRIDE(arrobj,0);
-    
-    for (k=0; k<N; k++) {
-        image = ConstituteImage(DIM(arrobj,2), DIM(arrobj,1),
-                                "I", stype, arrptr, &exception);
-        AppendImageToList(&images, image);
-        if PyMagickErr(exception) goto fail;
-        arrptr += step;
-    }
-    return images;
-
- fail:
-    if (images) DestroyImageList(images);
-    return NULL;
-}
-
 static Image*
 convert_palette_sequence (PyArrayObject *arrobj, PyArrayObject *pal, 
-                          ImageInfo *info) 
+                          ImageInfo *info, ExceptionInfo *exception)
 {
     int N, k, step;
     Image *images, *image=NULL;
     StorageType stype, paltype;
+    ExceptionInfo frame;
     char *arrptr;
     char *str,
         *str1 = "RGB",
@@ -1153,15 +1441,21 @@ convert_palette_sequence (PyArrayObject *arrobj, PyArrayObject *pal,
     arrptr = DATA(arrobj);
     step = STRIDE(arrobj,0);
     
+    Py_BEGIN_ALLOW_THREADS
     for (k=0; k<N; k++) {
-        image = ConstitutePaletteImage(DIM(arrobj,1), DIM(arrobj,2),
+        GetExceptionInfo(&frame);
+        image = ConstitutePaletteImage(DIM(arrobj,2), DIM(arrobj,1),
                                        stype, arrptr,
                                        str, paltype, DATA(pal),
-                                       DIM(pal,0), &exception);
+                                       DIM(pal,0), &frame);
         AppendImageToList(&images, image);
-        if PyMagickErr(exception) goto fail;
+        keep_exception(exception, &frame);
+        DestroyExceptionInfo(&frame);
+        if (MAGICK_FAILED(*exception)) break;
         arrptr += step;
     }
+    Py_END_ALLOW_THREADS
+    if PyMagickErr(*exception) goto fail;
     return images;
 
  fail:
@@ -1170,36 +1464,243 @@ convert_palette_sequence (PyArrayObject *arrobj, PyArrayObject *pal,
 }
 
 
-static Image*
-convert_colorspace_sequence(PyArrayObject *arrobj, ImageInfo *info)
+static Quantum
+norm_to_quantum(double val, double alpha, double beta)
 {
-    int N, k, step;
-    Image *images, *image=NULL;
-    StorageType stype;
-    char *arrptr;
-    char *str,
-        *str1 = "RGB",
-        *str2 = "CMYK",
-        *str3 = "RGBA";
+    val = alpha*val + beta;
+    if (val <= 0.0) return 0;
+    if (val >= 1.0) return MaxRGB;
+    return (Quantum) (MaxRGB*val + 0.5);
+}
 
-    N = DIM(arrobj,0);       /* The number of frames to convert */
-    images = NewImageList();    
+/* Find alpha and beta so that alpha*v+beta maps a float or double array
+   into [0,1].  The array may be strided; nothing is copied or modified.
+   Arrays already inside [0,1] get alpha=1, beta=0. */
+static void
+float_normalization(PyArrayObject *arrobj, double *alpha, double *beta)
+{
+    long idx[4] = {0, 0, 0, 0};
+    long k, N;
+    int d, nd, isfloat;
+    double val, maxval=0.0, minval=0.0, diff;
+    char *ptr;
 
-    if (DIM(arrobj,3) == 3) str=str1;
-    else if(info->colorspace == CMYKColorspace) str=str2;
-    else str=str3;
+    nd = RANK(arrobj);
+    N = PyArray_SIZE(arrobj);
+    isfloat = (TYPE(arrobj) == PyArray_FLOAT);
+    for (k=0; k<N; k++) {
+        ptr = DATA(arrobj);
+        for (d=0; d<nd; d++) ptr += idx[d]*STRIDE(arrobj,d);
+        val = isfloat ? *(float *)ptr : *(double *)ptr;
+        if ((k == 0) || (val > maxval)) maxval = val;
+        if ((k == 0) || (val < minval)) minval = val;
+        for (d=nd-1; d>=0; d--) {
+            if (++idx[d] < DIM(arrobj,d)) break;
+            idx[d] = 0;
+        }
+    }
 
-    stype = arraytype_to_storagetype(TYPE(arrobj));
+    *alpha = 1.0; *beta = 0.0;
+    if ((maxval <= 1) && (minval >= 0)) return;
+    diff = maxval - minval;
+    if (diff == 0.0) {
+        *alpha = 0.0; *beta = 0.0;
+    }
+    else {
+        *alpha = 1.0 / diff;
+        *beta = -minval / diff;
+    }
+}
+
+#define NormToQuantum(val) norm_to_quantum((double) (val), alpha, beta)
+
+#define STRIDED_ROW(ctype, convert) \
+    for (x=0; x < columns; x++) { \
+        q->red = convert(*(ctype *)p); \
+        if (channels < 3) \
+            q->green = q->blue = q->red; \
+        else { \
+            q->green = convert(*(ctype *)(p+cstride)); \
+            q->blue = convert(*(ctype *)(p+2*cstride)); \
+        } \
+        if (channels == 4) { \
+            q->opacity = convert(*(ctype *)(p+3*cstride)); \
+            if (!cmyk) q->opacity = MaxRGB - q->opacity; \
+        } \
+        else q->opacity = OpaqueOpacity; \
+        p += xstride; \
+        q++; \
+    }
+
+/* Layout of one frame of a strided array, for strided_row() and
+   run_row_bands() */
+typedef struct {
+    char *data;
+    int type, channels, cmyk;
+    long ystride, xstride, cstride, columns;
+    double alpha, beta;
+    PixelPacket *q;
+} StridedBand;
+
+static void
+strided_row(const StridedBand *b, const char *p, PixelPacket *q)
+{
+    const int channels = b->channels, cmyk = b->cmyk;
+    const long xstride = b->xstride, cstride = b->cstride;
+    const long columns = b->columns;
+    const double alpha = b->alpha, beta = b->beta;
+    register long x;
+
+    switch(b->type) {
+    case PyArray_CHAR:
+    case PyArray_UBYTE:
+        STRIDED_ROW(unsigned char, ScaleCharToQuantum);
+        break;
+    case PyArray_USHORT:
+        STRIDED_ROW(unsigned short, ScaleShortToQuantum);
+        break;
+    case PyArray_UINT:
+        STRIDED_ROW(unsigned int, ScaleLongToQuantum);
+        break;
+    case PyArray_LONG:
+        STRIDED_ROW(unsigned long, ScaleLongToQuantum);
+        break;
+    case PyArray_FLOAT:
+        STRIDED_ROW(float, NormToQuantum);
+        break;
+    case PyArray_DOUBLE:
+        STRIDED_ROW(double, NormToQuantum);
+        break;
+    }
+}
+
+static void
+strided_band(void *arg, long first, long last)
+{
+    StridedBand *b = (StridedBand *) arg;
+    long y;
+
+    for (y=first; y < last; y++)
+        strided_row(b, b->data + y*b->ystride, b->q + y*b->columns);
+}
+
+/* Build one image straight from a frame of a (possibly strided) array.
+
+   data points at element [0,0] of the frame whose rows are dimension ydim
+   of arrobj.  The dimension after the columns, if any, holds 3 (RGB) or
+   4 (RGBA, or CMYK if cmyk is set) channels; otherwise the frame is
+   grayscale.  Floating point input is normalized with alpha and beta in
+   the same pass, so no temporary array is needed.  Only the array's
+   memory is touched, so this may run without the interpreter lock.
+*/
+static Image*
+strided_to_image(PyArrayObject *arrobj, char *data, int ydim, int cmyk,
+                 double alpha, double beta, ExceptionInfo *exception)
+{
+    Image *image;
+    PixelPacket *q;
+    StridedBand b;
+    long y;
+
+    if ((DIM(arrobj,ydim) == 0) || (DIM(arrobj,ydim+1) == 0)) {
+        ThrowException(exception, OptionError, "UnableToConstituteImage",
+                       "NonzeroWidthAndHeightRequired");
+        return NULL;
+    }
+    b.data = data;
+    b.type = TYPE(arrobj);
+    b.channels = (RANK(arrobj) > ydim+2) ? DIM(arrobj,ydim+2) : 1;
+    b.cmyk = cmyk;
+    b.cstride = (b.channels > 1) ? STRIDE(arrobj,ydim+2) : 0;
+    b.ystride = STRIDE(arrobj,ydim);
+    b.xstride = STRIDE(arrobj,ydim+1);
+    b.columns = DIM(arrobj,ydim+1);
+    b.alpha = alpha;
+    b.beta = beta;
+
+    image = AllocateImage((ImageInfo *) NULL);
+    if (image == NULL) {
+        ThrowException(exception, ResourceLimitError, 
+                       "MemoryAllocationFailed", "UnableToConstituteImage");
+        return NULL;
+    }
+    image->columns = b.columns;
+    image->rows = DIM(arrobj,ydim);
+    if (b.channels == 4) {
+        if (cmyk) image->colorspace = CMYKColorspace;
+        else image->matte = True;
+    }
+
+    if ((_workers > 1) && ((b.q = get_frame_pixels(image)) != NULL)) {
+        run_row_bands(strided_band, &b, (long) image->rows, b.columns);
+        y = SyncImagePixels(image) ? (long) image->rows : 0;
+    }
+    else for (y=0; y < (long) image->rows; y++) {
+        q = SetImagePixels(image, 0, y, image->columns, 1);
+        if (q == NULL) break;
+        strided_row(&b, data + y*b.ystride, q);
+        if (!SyncImagePixels(image)) break;
+    }
+    if (y < (long) image->rows) {
+        ThrowException(exception, image->exception.severity,
+                       image->exception.reason, 
+                       image->exception.description);
+        DestroyImage(image);
+        return NULL;
+    }
+    return image;
+}
+
+static Image*
+convert_grayscale(PyArrayObject *arrobj, double alpha, double beta,
+                  ExceptionInfo *exception) 
+{
+    Image *image;
+
+    Py_BEGIN_ALLOW_THREADS
+    image = strided_to_image(arrobj, DATA(arrobj), 0, False, alpha, beta,
+                             exception);
+    Py_END_ALLOW_THREADS
+    return image;
+}
+
+static Image*
+convert_colorspace(PyArrayObject *arrobj, ImageInfo *info, double alpha,
+                   double beta, ExceptionInfo *exception)
+{
+    Image *image;
+
+    Py_BEGIN_ALLOW_THREADS
+    image = strided_to_image(arrobj, DATA(arrobj), 0, 
+                             info->colorspace == CMYKColorspace,
+                             alpha, beta, exception);
+    Py_END_ALLOW_THREADS
+    return image;
+}
+
+/* Handles KxMxN (grayscale) and KxMxNx3 or KxMxNx4 sequences */
+static Image*
+convert_sequence(PyArrayObject *arrobj, ImageInfo *info, double alpha,
+                 double beta, ExceptionInfo *exception)
+{
+    int N, k;
+    Image *images, *image=NULL;
+    char *arrptr;
+
+    N = DIM(arrobj,0);  /* The number of frames to convert */
+    images = NewImageList();    
     arrptr = DATA(arrobj);
-    step = STRIDE(arrobj,0);
-    
+    Py_BEGIN_ALLOW_THREADS
     for (k=0; k<N; k++) {
-        image = ConstituteImage(DIM(arrobj,2), DIM(arrobj,1),
-                                str, stype, arrptr, &exception);
+        image = strided_to_image(arrobj, arrptr, 1, 
+                                 info->colorspace == CMYKColorspace,
+                                 alpha, beta, exception);
+        if (image == NULL) break;
         AppendImageToList(&images, image);
-        if PyMagickErr(exception) goto fail;
-        arrptr += step;
+        arrptr += STRIDE(arrobj,0);
     }
+    Py_END_ALLOW_THREADS
+    if (image == NULL) goto fail;
     return images;
 
  fail:
@@ -1208,7 +1709,6 @@ convert_colorspace_sequence(PyArrayObject *arrobj, ImageInfo *info)
 }
 
 
-
 static void 
 normalize_DOUBLE(PyArrayObject *arrobj)
 {
@@ -1311,9 +1811,12 @@ Convert_From_Array(PyObject *in, ImageInfo *info)
     PyObject *obj, *pal;
     PyArrayObject *arrobj=NULL, *palobj=NULL, *newobj=NULL;
     int nd, N;
-    int type_num;
+    int type_num, isfloat;
+    double alpha=1.0, beta=0.0;
     Image *image=NULL;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (PyTuple_Check(in)) { /* Palette image */
         if ((N=PyTuple_Size(in)) != 2) ERRMSG("If object is a tuple, then it must be of length 2 (array, palette)");
         obj = PyTuple_GET_ITEM(in, 0);
@@ -1345,10 +1848,16 @@ Convert_From_Array(PyObject *in, ImageInfo *info)
     }
     
     else obj = in;
-        
-    arrobj = (PyArrayObject *)PyArray_ContiguousFromObject(obj, \
-                                                           PyArray_NOTYPE,\
-                                                           0,0);
+
+    /* Arrays are used as they are (strides and all); anything else is
+       converted once. */
+    if (PyArray_Check(obj)) {
+        Py_INCREF(obj);
+        arrobj = (PyArrayObject *)obj;
+    }
+    else arrobj = (PyArrayObject *)PyArray_ContiguousFromObject(obj, \
+                                                               PyArray_NOTYPE,\
+                                                               0,0);
     if (arrobj == NULL) ERRMSG("Cannot convert object to array.");
     nd = RANK(arrobj);
     
@@ -1360,42 +1869,60 @@ Convert_From_Array(PyObject *in, ImageInfo *info)
            (type_num==PyArray_LONG) || (type_num==PyArray_FLOAT) || \
            (type_num==PyArray_DOUBLE)))
         ERRMSG("Only unsigned integers, floats or doubles accepted");
+    isfloat = (type_num==PyArray_FLOAT) || (type_num==PyArray_DOUBLE);
 
-    /* normalize float or double (if not a bitmap output) */
-    if (((type_num==PyArray_FLOAT) || (type_num==PyArray_DOUBLE)) \
-        && (info->monochrome != 1)) {
-    if ((newobj = (PyArrayObject *)PyArray_Copy(arrobj))==NULL)
-            ERRMSG("Could not copy array for normalization.");
-        if (type_num == PyArray_FLOAT)
-            normalize_FLOAT(newobj);
-        else
-            normalize_DOUBLE(newobj);
+    /* Bitmaps and palette indexes are read linearly */
+    if (info->monochrome || (palobj != NULL)) {
+        newobj = (PyArrayObject *)PyArray_ContiguousFromObject( \
+            (PyObject *)arrobj, PyArray_NOTYPE, 0, 0);
+        if (newobj == NULL) goto fail;
         Py_DECREF(arrobj);
         arrobj = newobj;
     }
 
+    /* normalize float or double (if not a bitmap output).  Palette
+       indexes are normalized in a copy; everything else is normalized
+       on the fly while the pixels are written. */
+    if (isfloat && (info->monochrome != 1)) {
+        if (palobj != NULL) {
+            if ((newobj = (PyArrayObject *)PyArray_Copy(arrobj))==NULL)
+                ERRMSG("Could not copy array for normalization.");
+            if (type_num == PyArray_FLOAT)
+                normalize_FLOAT(newobj);
+            else
+                normalize_DOUBLE(newobj);
+            Py_DECREF(arrobj);
+            arrobj = newobj;
+        }
+        else float_normalization(arrobj, &alpha, &beta);
+    }
+
     /* Test for different cases */ 
    
     if (nd == 2) {
-        if (info->monochrome) image = convert_bitmap(arrobj);
-        else if (palobj == NULL) image = convert_grayscale(arrobj);
-        else image = convert_palette(arrobj, palobj, info);
+        if (info->monochrome) image = convert_bitmap(arrobj, &exception);
+        else if (palobj == NULL) 
+            image = convert_grayscale(arrobj, alpha, beta, &exception);
+        else image = convert_palette(arrobj, palobj, info, &exception);
     }
     else if (nd == 3) {
         if (info->colorspace==GRAYColorspace) 
-            image = convert_grayscale_sequence(arrobj, info);
+            image = convert_sequence(arrobj, info, alpha, beta, &exception);
         else if (palobj != NULL) 
-            image = convert_palette_sequence(arrobj, palobj, info);
+            image = convert_palette_sequence(arrobj, palobj, info,
+                                             &exception);
         else if ((DIM(arrobj,2) < 3) || (DIM(arrobj,2) > 4))
-            image = convert_grayscale_sequence(arrobj, info);
-        else image = convert_colorspace(arrobj, info);
+            image = convert_sequence(arrobj, info, alpha, beta, &exception);
+        else image = convert_colorspace(arrobj, info, alpha, beta, 
+                                        &exception);
     }
     else {  /* nd == 4 */
         if ((DIM(arrobj,3) < 3) || (DIM(arrobj,3) > 4))
             ERRMSG("Last dimension of array must be 3 or 4.");
-        image = convert_colorspace_sequence(arrobj, info);
+        image = convert_sequence(arrobj, info, alpha, beta, &exception);
     }
     CHECK_ERR;
+    if (image == NULL) ERRMSG("Could not convert array to image.");
     Py_DECREF(arrobj);
     Py_XDECREF(palobj);
     return image;
@@ -1406,6 +1933,428 @@ Convert_From_Array(PyObject *in, ImageInfo *info)
     return NULL;
 }
 
+/*
+  Decoded-image cache.
+
+  Off until magick.imagecache(maxbytes) is called.  Images read from a
+  filename are kept under a key made of the path, its modification time
+  and size, and the ImageInfo fields that change how it is decoded.
+  Callers get a CloneImageList() of the cached list; the clones share
+  the pixel cache, which GraphicsMagick copies the first time a clone
+  is modified.  Entries are kept in least-recently-used order and the
+  oldest are dropped while the pixels held exceed maxbytes.  Only used
+  with the interpreter lock held.
+*/
+typedef struct _CacheEntry {
+    struct _CacheEntry *prev, *next;
+    Image *images;
+    size_t bytes;
+    char *key;
+} CacheEntry;
+
+static CacheEntry *_cachehead = NULL, *_cachetail = NULL;
+static size_t _cachebytes = 0, _cachemax = 0;
+static long _cacheentries = 0, _cachehits = 0, _cachemisses = 0;
+
+static void
+cache_unlink(CacheEntry *e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else _cachehead = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else _cachetail = e->prev;
+}
+
+static void
+cache_push(CacheEntry *e)
+{
+    e->prev = NULL;
+    e->next = _cachehead;
+    if (_cachehead) _cachehead->prev = e;
+    else _cachetail = e;
+    _cachehead = e;
+}
+
+/* Drop least recently used entries until at most maxbytes are held */
+static void
+cache_trim(size_t maxbytes)
+{
+    CacheEntry *e;
+
+    while ((_cachetail != NULL) && (_cachebytes > maxbytes)) {
+        e = _cachetail;
+        cache_unlink(e);
+        _cachebytes -= e->bytes;
+        _cacheentries--;
+        DestroyImageList(e->images);
+        MagickFree(e);
+    }
+}
+
+static size_t
+image_list_bytes(const Image *images)
+{
+    size_t bytes = 0;
+
+    for (; images; images=images->next) {
+        bytes += images->columns*images->rows*sizeof(PixelPacket);
+        if (images->storage_class == PseudoClass)
+            bytes += images->columns*images->rows*sizeof(IndexPacket) +
+                images->colors*sizeof(PixelPacket);
+    }
+    return bytes;
+}
+
+#define STRORNULL(str) ((str) ? (str) : "")
+
+/* Nanoseconds of the modification time, where struct stat has them */
+#if defined(__APPLE__)
+#define STAT_MTIME_NSEC(st) ((long) (st).st_mtimespec.tv_nsec)
+#elif defined(st_mtime)
+#define STAT_MTIME_NSEC(st) ((long) (st).st_mtim.tv_nsec)
+#else
+#define STAT_MTIME_NSEC(st) 0L
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Write the cache key for reading info->filename to key.  The file is
+   named by its resolved path, device and inode, so every name for it
+   shares one entry, and dated to the nanosecond where the platform
+   allows.  Returns 0 if the name is not a plain file (e.g. "rose:" or
+   "png:-") or the key does not fit. */
+static int
+cache_key(const ImageInfo *info, char *key, size_t length)
+{
+    struct stat st;
+    char path[PATH_MAX];
+    int n;
+
+    if (stat(info->filename, &st) != 0) return 0;
+    if (!S_ISREG(st.st_mode)) return 0;
+    if (realpath(info->filename, path) == NULL) return 0;
+    n = PyOS_snprintf(key, length, "%s|%lu|%lu|%ld.%09ld|%ld|%s|%s|%s|%d|"
+                      "%lu|%lu|%lu|%u|%u|%u|%d|%d|%d",
+                      path, (unsigned long) st.st_dev, 
+                      (unsigned long) st.st_ino, (long) st.st_mtime, 
+                      STAT_MTIME_NSEC(st), (long) st.st_size,
+                      STRORNULL(info->size), STRORNULL(info->density),
+                      STRORNULL(info->page), (int) info->colorspace,
+                      info->depth, info->subimage, info->subrange,
+                      info->monochrome, info->ping, info->antialias,
+                      (int) info->endian, (int) info->interlace, 
+                      (int) info->units);
+    return (n > 0) && ((size_t) n < length);
+}
+
+/* ReadImage() through the decoded-image cache */
+static Image *
+cached_read(ImageInfo *image_info, ExceptionInfo *exception)
+{
+    char key[2*MaxTextExtent];
+    CacheEntry *e;
+    Image *image;
+
+    if ((_cachemax == 0) || !cache_key(image_info, key, sizeof(key)))
+        return ReadImage(image_info, exception);
+    for (e=_cachehead; e; e=e->next)
+        if (strcmp(e->key, key) == 0) break;
+    if (e != NULL) {
+        _cachehits++;
+        cache_unlink(e);
+        cache_push(e);
+        return CloneImageList(e->images, exception);
+    }
+
+    _cachemisses++;
+    image = ReadImage(image_info, exception);
+    if ((image == NULL) || MAGICK_FAILED(*exception)) return image;
+    if (image_list_bytes(image) > _cachemax) return image;
+    e = (CacheEntry *) MagickMalloc(sizeof(CacheEntry) + strlen(key) + 1);
+    if (e == NULL) return image;
+    e->images = image;
+    e->bytes = image_list_bytes(image);
+    e->key = (char *) (e + 1);
+    strcpy(e->key, key);
+    cache_push(e);
+    _cachebytes += e->bytes;
+    _cacheentries++;
+    cache_trim(_cachemax);
+    return CloneImageList(image, exception);
+}
+
+#undef STRORNULL
+
+/*
+  Instrumentation.
+
+  magick.stats(1) switches on per-call accounting for the module
+  functions and the image methods, and per-coder accounting for
+  decoding (magick.image() from a file or a blob) and encoding (write(),
+  tobytes()).  Every entry counts calls and errors, total and longest
+  wall time, pixels (of the image returned, or of img for methods that
+  change it in place) and bytes requested from the allocator while the
+  call ran.  Bytes are only counted when the module supplies the
+  allocator (GraphicsMagick 1.2 or later); they leave out pixel caches,
+  which GraphicsMagick allocates itself, and include allocations made
+  by other threads during the call.
+
+  The module functions are bound to stats_call() once at import time
+  and only pay for a flag test while accounting is off.  Image methods
+  are wrapped in mimage_getattr() only while it is on.  All tables are
+  updated with the interpreter lock held.
+*/
+#define STAT_CODERS 64
+
+typedef struct {
+    long calls;
+    long errors;
+    double seconds;
+    double max;
+    double pixels;
+    double bytes;
+} StatEntry;
+
+typedef struct {
+    char name[MaxTextExtent];
+    StatEntry entry[2];         /* STAT_DECODE, STAT_ENCODE */
+} StatCoder;
+
+#define STAT_DECODE 0
+#define STAT_ENCODE 1
+
+static int _statson = 0;
+static volatile unsigned long _statalloc = 0;
+static PyMethodDef **_statorig = NULL;  /* the functions accounted for */
+static PyMethodDef *_statdefs = NULL;   /* the same, calling stats_call */
+static StatEntry *_statfuncs = NULL;
+static long _statcount = 0;
+static StatCoder _statcoders[STAT_CODERS];
+static long _statncoders = 0;
+
+#ifdef __GNUC__
+#define STAT_ALLOC(n) {if (_statson) \
+    (void) __sync_fetch_and_add(&_statalloc, (unsigned long)(n));}
+#else
+#define STAT_ALLOC(n) {if (_statson) _statalloc += (unsigned long)(n);}
+#endif
+
+static double
+stats_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static double
+stats_pixels(const Image *images)
+{
+    double pixels = 0;
+
+    for (; images; images=images->next)
+        pixels += (double) images->columns * images->rows;
+    return pixels;
+}
+
+static void
+stats_add(StatEntry *s, double start, unsigned long alloc0, double pixels,
+          int failed)
+{
+    double t = stats_now() - start;
+
+    s->calls++;
+    if (failed) s->errors++;
+    s->seconds += t;
+    if (t > s->max) s->max = t;
+    s->pixels += pixels;
+    s->bytes += (double) (_statalloc - alloc0);
+}
+
+/* Start timing a decode or encode; 0 if accounting is off */
+static double
+stats_start(unsigned long *alloc0)
+{
+    if (!_statson) return 0;
+    *alloc0 = _statalloc;
+    return stats_now();
+}
+
+/* Account a decode or encode of images by the coder named magick */
+static void
+stats_coder(int op, const char *magick, const Image *images, double start,
+            unsigned long alloc0)
+{
+    long k;
+
+    if (!_statson || (start == 0)) return;
+    if ((magick == NULL) || (*magick == '\0')) magick = "unknown";
+    for (k=0; k < _statncoders; k++)
+        if (strcmp(_statcoders[k].name, magick) == 0) break;
+    if (k == _statncoders) {
+        if (k == STAT_CODERS) return;
+        memset(&_statcoders[k], 0, sizeof(StatCoder));
+        strncpy(_statcoders[k].name, magick, MaxTextExtent-1);
+        _statncoders++;
+    }
+    stats_add(&_statcoders[k].entry[op], start, alloc0, stats_pixels(images),
+              images == NULL);
+}
+
+/* Call the original function def with self */
+static PyObject *
+stats_dispatch(PyMethodDef *def, PyObject *self, PyObject *args,
+               PyObject *kwds)
+{
+    int n = PyTuple_GET_SIZE(args);
+
+    if (def->ml_flags & METH_KEYWORDS)
+        return ((PyCFunctionWithKeywords) def->ml_meth)(self, args, kwds);
+    if (kwds && (PyDict_Size(kwds) > 0)) {
+        PyErr_Format(PyExc_TypeError, "%.200s() takes no keyword arguments",
+                     def->ml_name);
+        return NULL;
+    }
+    if (def->ml_flags & METH_O) {
+        if (n != 1) {
+            PyErr_Format(PyExc_TypeError, "%.200s() takes exactly one "
+                         "argument (%d given)", def->ml_name, n);
+            return NULL;
+        }
+        return def->ml_meth(self, PyTuple_GET_ITEM(args, 0));
+    }
+    if (def->ml_flags & METH_NOARGS) {
+        if (n != 0) {
+            PyErr_Format(PyExc_TypeError, "%.200s() takes no arguments "
+                         "(%d given)", def->ml_name, n);
+            return NULL;
+        }
+        return def->ml_meth(self, NULL);
+    }
+    return def->ml_meth(self, args);
+}
+
+/* All accounted functions end up here.  bound is (index,) for module
+   functions and (index, img) for image methods. */
+static PyObject *
+stats_call(PyObject *bound, PyObject *args, PyObject *kwds)
+{
+    long k = PyInt_AS_LONG(PyTuple_GET_ITEM(bound, 0));
+    PyObject *self = NULL, *res;
+    unsigned long alloc0;
+    double start, pixels = 0;
+
+    if (PyTuple_GET_SIZE(bound) > 1) self = PyTuple_GET_ITEM(bound, 1);
+    if (!_statson) return stats_dispatch(_statorig[k], self, args, kwds);
+
+    alloc0 = _statalloc;
+    start = stats_now();
+    res = stats_dispatch(_statorig[k], self, args, kwds);
+    if ((res != NULL) && PyMImage_Check(res))
+        pixels = stats_pixels(ASIM(res)->ims);
+    else if ((res != NULL) && (self != NULL) && PyMImage_Check(self))
+        pixels = stats_pixels(ASIM(self)->ims);
+    if (_statson) stats_add(&_statfuncs[k], start, alloc0, pixels, 
+                            res == NULL);
+    return res;
+}
+
+/* Accounting copy of the method func (found by Py_FindMethod), or func
+   itself if it is not accounted for.  Steals the reference to func. */
+static PyObject *
+stats_bind(PyObject *func, PyObject *self)
+{
+    PyMethodDef *ml;
+    PyObject *bound, *res;
+    long k;
+
+    if (!PyCFunction_Check(func)) return func;
+    ml = ((PyCFunctionObject *)func)->m_ml;
+    for (k=0; k < _statcount; k++)
+        if (_statorig[k] == ml) break;
+    if (k == _statcount) return func;
+    Py_DECREF(func);
+    bound = Py_BuildValue("(lO)", k, self);
+    if (bound == NULL) return NULL;
+    res = PyCFunction_New(&_statdefs[k], bound);
+    Py_DECREF(bound);
+    return res;
+}
+
+/* Set up accounting for the functions of the module (whose dictionary
+   is d) and the image methods.  Module functions are rebound in d. */
+static int
+stats_init(PyObject *d, PyMethodDef *module, PyMethodDef *methods)
+{
+    PyMethodDef *ml;
+    PyObject *bound, *func;
+    long k, nmodule;
+
+    for (ml=module; ml->ml_name; ml++) _statcount++;
+    nmodule = _statcount;
+    for (ml=methods; ml->ml_name; ml++) _statcount++;
+    _statorig = PyMem_New(PyMethodDef *, _statcount);
+    _statdefs = PyMem_New(PyMethodDef, _statcount);
+    _statfuncs = PyMem_New(StatEntry, _statcount);
+    if (!_statorig || !_statdefs || !_statfuncs) {
+        _statcount = 0;
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(_statfuncs, 0, _statcount*sizeof(StatEntry));
+    for (k=0; k < _statcount; k++) {
+        _statorig[k] = (k < nmodule) ? &module[k] : &methods[k-nmodule];
+        _statdefs[k] = *_statorig[k];
+        _statdefs[k].ml_meth = (PyCFunction) stats_call;
+        _statdefs[k].ml_flags = METH_VARARGS|METH_KEYWORDS;
+    }
+    for (k=0; k < nmodule; k++) {
+        bound = Py_BuildValue("(l)", k);
+        if (bound == NULL) return -1;
+        func = PyCFunction_New(&_statdefs[k], bound);
+        Py_DECREF(bound);
+        if (func == NULL) return -1;
+        PyDict_SetItemString(d, _statdefs[k].ml_name, func);
+        Py_DECREF(func);
+    }
+    return 0;
+}
+
+/*
+  Allocator hooks.  Where GraphicsMagick lets us supply the allocator
+  (MagickAllocFunctions, 1.2 and later) the module routes it through
+  these so that stats() can count the bytes requested.  A realloc()
+  counts its whole new size, since the old size is not known here, so
+  buffers that grow are counted more than once.  Pixel caches are not
+  among them: GraphicsMagick allocates those aligned or mapped, outside
+  these hooks.
+*/
+#ifdef HAVE_MAGICK_ALLOC_FUNCTIONS
+static void *
+count_malloc(size_t size)
+{
+    STAT_ALLOC(size);
+    return malloc(size);
+}
+
+static void
+count_free(void *ptr)
+{
+    free(ptr);
+}
+
+static void *
+count_realloc(void *ptr, size_t size)
+{
+    STAT_ALLOC(size);
+    return realloc(ptr, size);
+}
+#endif
+
+
 /* Converts an object to an image.
 
    The object can be:
@@ -1441,7 +2390,11 @@ _convert_object(PyObject *in, ImageInfo *info)
 {
     Image *image = NULL;
     ImageInfo *image_info = NULL;
+    unsigned long alloc0 = 0;
+    double start;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
        /* Clone an image */
     if PyMImage_Check(in) {
         image = CloneImageList(((PyMImageObject *)in)->ims,&exception);
@@ -1453,14 +2406,20 @@ _convert_object(PyObject *in, ImageInfo *info)
     
         (void ) strcpy(image_info->filename,
                        PyString_AS_STRING((PyObject *)in));
-        image = ReadImage(image_info, &exception);
+        start = stats_start(&alloc0);
+        image = cached_read(image_info, &exception);
+        stats_coder(STAT_DECODE, image ? image->magick : NULL, image, start,
+                    alloc0);
     if (image_info) DestroyImageInfo(image_info);
         CHECK_ERR;
     }
     else if PyFile_Check(in) {
         image_info = CloneImageInfo((ImageInfo *)info);        
         image_info->file = PyFile_AsFile(in);
+        start = stats_start(&alloc0);
         image = ReadImage(image_info, &exception);
+        stats_coder(STAT_DECODE, image ? image->magick : NULL, image, start,
+                    alloc0);
     if (image_info) DestroyImageInfo(image_info);
         CHECK_ERR;
     }
@@ -1475,12 +2434,53 @@ fail:
 }
 
 
+/* True if obj is a file name or stream holding a JPEG.  That is the
+   only codec that takes the size of the ImageInfo as a hint to decode
+   smaller; for GRAY, RGB, UYVY and other raw formats it is the image
+   geometry.  Names are judged by their prefix or extension, as
+   SetImageInfo() does, and streams by their first bytes. */
+static int
+decodes_scaled(PyObject *obj)
+{
+    ImageInfo *probe;
+    ExceptionInfo exception;
+    unsigned char magic[3];
+    FILE *fp;
+    long pos;
+    int jpeg = False;
+
+    if (PyString_Check(obj)) {
+        probe = CloneImageInfo((ImageInfo *)NULL);
+        if (probe == NULL) return False;
+        GetExceptionInfo(&exception);
+        (void) strncpy(probe->filename, PyString_AS_STRING(obj), 
+                       MaxTextExtent-1);
+        if (SetImageInfo(probe, False, &exception))
+            jpeg = (strcmp(probe->magick, "JPEG") == 0) || 
+                (strcmp(probe->magick, "JPG") == 0);
+        DestroyExceptionInfo(&exception);
+        DestroyImageInfo(probe);
+    }
+    else if (PyFile_Check(obj)) {
+        fp = PyFile_AsFile(obj);
+        if ((pos = ftell(fp)) < 0) return False;  /* a pipe */
+        jpeg = (fread(magic, 1, 3, fp) == 3) && (magic[0] == 0xFF) &&
+            (magic[1] == 0xD8) && (magic[2] == 0xFF);
+        if (fseek(fp, pos, SEEK_SET) != 0) return False;
+    }
+    return jpeg;
+}
+
+/* Like mimage_from_object(), but a JPEG file name or stream is decoded
+   with a size hint of columns x rows (0 if not known), so it comes out
+   smaller but still at least that large. */
 static PyObject*
-mimage_from_object(PyObject *obj)
+mimage_from_object_sized(PyObject *obj, long columns, long rows)
 {
     PyMImageObject *new=NULL;
     ImageInfo *info=NULL;
     Image *im;
+    char size[MaxTextExtent];
 
     if (PyMImage_Check(obj)) {
     Py_INCREF(obj);
@@ -1488,9 +2488,15 @@ mimage_from_object(PyObject *obj)
     }
     
     info = CloneImageInfo((ImageInfo *)NULL);
+    if (((columns > 0) || (rows > 0)) && decodes_scaled(obj)) {
+        PyOS_snprintf(size, sizeof(size), "%ldx%ld", 
+                      (columns > 0) ? columns : 1L, 
+                      (rows > 0) ? rows : 1L);
+        info->size = AllocateString(size);
+    }
     im =_convert_object(obj, info);
     if (im==NULL) goto fail;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
     new->ims = im;
     if (info) DestroyImageInfo(info);
@@ -1501,6 +2507,12 @@ mimage_from_object(PyObject *obj)
     return NULL;
 }
 
+static PyObject*
+mimage_from_object(PyObject *obj)
+{
+    return mimage_from_object_sized(obj, 0, 0);
+}
+
 /* take a Python object representing a color for optional keyword 
     The Python object can be: 
 
@@ -1519,7 +2531,9 @@ set_color_from_obj(PixelPacket *packet, PyObject *obj, char *keyname)
     int len;
     char *cstr;
     PyObject *itobj=NULL;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
     if (PyString_Check(obj)) {
         cstr = PyString_AS_STRING(obj);
         len = PyString_GET_SIZE(obj);
@@ -1619,7 +2633,7 @@ update_info_from_kwds(ImageInfo *info, PyObject* kwds)
         case 'c':
             if (strEQ(skey,"colorspace")) {
                 if (!tmpstr) goto fail;
-                if ((ind = LookupStr(ColorspaceTypes, tmpstr)) < 0)
+                if ((ind = lookup_colorspace(tmpstr)) < 0)
                     ERRMSG3(tmpstr,skey);
                 info->colorspace = (ColorspaceType) ind;
             }
@@ -1686,6 +2700,10 @@ update_info_from_kwds(ImageInfo *info, PyObject* kwds)
                 if (PyErr_Occurred()) goto fail;
                 info->fuzz = tmpdouble;   /* double not int as web-docs say */
             }
+            else if (strEQ(skey, "format")) {  /* same as magick */
+                if (!tmpstr) goto fail;
+                strncpy(info->magick,tmpstr,MaxTextExtent-1);
+            }
             else ERRMSG2;
             break;
         case 'I':
@@ -1809,11 +2827,45 @@ update_info_from_kwds(ImageInfo *info, PyObject* kwds)
 #undef ERRMSG2
 
 
-static char doc_image[] = "image(obj1, {obj2, ...}) create an Image Magick image.  obj can be a file name, a file stream, another image object, an array object, or a 2-tuple of an array object and a second object (either a string or a palette array) describing how to interpret the array data.  Multiple objects can be combined into an image sequence using repeating arguments.";
+/* Decode an image from any object with the buffer interface without
+   copying the data.  A string cannot change while it is decoded, so the
+   interpreter lock is released for it. */
+static Image *
+blob_to_image(PyObject *obj, ImageInfo *info)
+{
+    const void *data;
+    Py_ssize_t length;
+    Image *image = NULL;
+    unsigned long alloc0 = 0;
+    double start;
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+    if (PyObject_AsReadBuffer(obj, &data, &length) < 0) return NULL;
+    start = stats_start(&alloc0);
+    if (PyString_Check(obj)) {
+        Py_BEGIN_ALLOW_THREADS
+        image = BlobToImage(info, data, (size_t) length, &exception);
+        Py_END_ALLOW_THREADS
+    }
+    else image = BlobToImage(info, data, (size_t) length, &exception);
+    stats_coder(STAT_DECODE, image ? image->magick : info->magick, image,
+                start, alloc0);
+    CHECK_ERR;
+    if (image == NULL) ERRMSG("Could not decode blob.");
+    return image;
+
+ fail:
+    if (image) DestroyImageList(image);
+    return NULL;
+}
+
+static char doc_image[] = "image(obj1, {obj2, ...}) create an Image Magick image.  obj can be a file name, a file stream, another image object, an array object, or a 2-tuple of an array object and a second object (either a string or a palette array) describing how to interpret the array data.  Multiple objects can be combined into an image sequence using repeating arguments.\n\n blob= gives encoded image data (a string or any object with the buffer interface) to decode, appended after the other objects.  format= names its format when it cannot be detected.";
 static PyObject *
 magick_new_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
     PyMImageObject *obj=NULL;
+    PyObject *blob=NULL, *opts=NULL;
     ImageInfo *info=NULL;
     Image *images=NULL, *im=NULL;
     int N, k;
@@ -1822,12 +2874,19 @@ magick_new_image(PyObject *self, PyObject *args, PyObject *kwds)
        (kwds && !PyDict_Check(kwds)))
     ERRMSG("Invalid argument to internal function.");
 
-    obj = PyObject_New(PyMImageObject, &MImage_Type);
+    obj = mimage_alloc();
     if (obj == NULL) goto fail;
     obj->ims = NULL;
    
     if (!(info = CloneImageInfo((ImageInfo *)NULL))) ERRMSG("Resource error.");
-    if ((N > 0) && (kwds != NULL))
+    /* blob= is only meaningful here; the other keywords go to the info */
+    if ((kwds != NULL) && 
+        ((blob = PyDict_GetItemString(kwds, "blob")) != NULL)) {
+        if ((opts = PyDict_Copy(kwds)) == NULL) goto fail;
+        if (PyDict_DelItemString(opts, "blob") < 0) goto fail;
+        kwds = opts;
+    }
+    if (kwds != NULL)
         if (!update_info_from_kwds(info, kwds))
             goto fail;
     k = 0;
@@ -1836,11 +2895,18 @@ magick_new_image(PyObject *self, PyObject *args, PyObject *kwds)
         if (im == NULL) goto fail;
         AppendImageToList(&images, im);                          
     }
+    if (blob != NULL) {
+        im = blob_to_image(blob, info);
+        if (im == NULL) goto fail;
+        AppendImageToList(&images, im);
+    }
+    Py_XDECREF(opts);
     DestroyImageInfo(info);
     obj->ims = images;
     return (PyObject *)obj;
 
 fail:
+    Py_XDECREF(opts);
     Py_XDECREF(obj);
     if (info) DestroyImageInfo(info);
     if (images) DestroyImageList(images);
@@ -1855,6 +2921,7 @@ mimage_dealloc(PyObject *self)
     obj = ASIM(self);
     if (obj && obj->ims)
         DestroyImageList(obj->ims);
+    if (obj) PyMem_Free(obj->frames);
     PyObject_Del(self);
 }
 
@@ -1864,7 +2931,9 @@ static char doc_write_image[] = "img.write(<filename>) \n"\
 static PyObject *
 write_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    int N;
+    int N, ok;
+    unsigned long alloc0 = 0;
+    double start;
     PyObject *in;
     PyMImageObject *imobj;
     ImageInfo *info=NULL;
@@ -1893,7 +2962,11 @@ write_image(PyObject *self, PyObject *args, PyObject *kwds)
     }
     else if (imobj->ims->filename == NULL) ERRMSG("Image has no filename.");
 
-    if (!WriteImage(info, imobj->ims))
+    start = stats_start(&alloc0);
+    ok = WriteImage(info, imobj->ims);
+    stats_coder(STAT_ENCODE, imobj->ims->magick, ok ? imobj->ims : NULL, 
+                start, alloc0);
+    if (!ok)
         ERR(imobj->ims->exception);
 
     DestroyImageInfo(info);
@@ -1906,16 +2979,80 @@ write_image(PyObject *self, PyObject *args, PyObject *kwds)
 
 }
 
-static char doc_display_image[] = "display an image to the screen.";
+
+static char doc_tobytes_image[] = "blob = img.tobytes(<format>) \n"\
+" Encode the image (every frame, if the format allows it) in memory and\n"\
+"   return the data as a buffer object.  format is a GraphicsMagick\n"\
+"   format name such as 'PNG' or 'JPEG', and defaults to the format the\n"\
+"   image was read from.  Other keywords update image_info as in write().";
 static PyObject *
-display_image(PyObject *self, PyObject *args, PyObject *kwds)
+tobytes_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
-    PyMImageObject *imobj = (PyMImageObject *)self;
+    PyMImageObject *imobj = ASIM(self);
+    PyBlobObject *blob=NULL;
     ImageInfo *info=NULL;
+    char *format=NULL;
+    Image *images=NULL;
+    void *data;
+    size_t length = 0;
+    unsigned long alloc0 = 0;
+    double start;
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+    if (!PyArg_ParseTuple(args, "|s", &format)) return NULL;
+    if (!(imobj->ims)) ERRMSG("No image to encode");
 
     info = CloneImageInfo(NULL);
-    if (!PyArg_ParseTuple(args,""))
-        return NULL;
+    if ((kwds) && !update_info_from_kwds(info, kwds))
+        goto fail;
+    if (format != NULL) strncpy(info->magick, format, MaxTextExtent-1);
+    blob = PyObject_New(PyBlobObject, &Blob_Type);
+    if (blob == NULL) goto fail;
+    blob->data = NULL;
+    blob->length = 0;
+
+    /* Encode frames of our own: other threads may change the list (or
+       encode it) while the interpreter lock is released.  ImageToBlob()
+       encodes in the format named by the first frame. */
+    images = share_frames(imobj->ims, -1, &exception);
+    CHECK_ERR;
+    if (images == NULL) ERRMSG("Could not copy image list.");
+    if (*info->magick)
+        strcpy(images->magick, info->magick);
+    start = stats_start(&alloc0);
+    Py_BEGIN_ALLOW_THREADS
+    data = ImageToBlob(info, images, &length, &exception);
+    Py_END_ALLOW_THREADS
+    stats_coder(STAT_ENCODE, images->magick, data ? images : NULL,
+                start, alloc0);
+    DestroyImageList(images);
+    images = NULL;
+    blob->data = data;
+    blob->length = length;
+    CHECK_ERR;
+    if (data == NULL) ERRMSG("Could not encode image.");
+
+    DestroyImageInfo(info);
+    return (PyObject *)blob;
+
+ fail:
+    if (images) DestroyImageList(images);
+    if (info) DestroyImageInfo(info);
+    Py_XDECREF(blob);
+    return NULL;
+}
+
+static char doc_display_image[] = "display an image to the screen.";
+static PyObject *
+display_image(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyMImageObject *imobj = (PyMImageObject *)self;
+    ImageInfo *info=NULL;
+
+    info = CloneImageInfo(NULL);
+    if (!PyArg_ParseTuple(args,""))
+        return NULL;
     if ((kwds) && !update_info_from_kwds(info, kwds))
         goto fail;
     if (imobj->ims)
@@ -1957,17 +3094,80 @@ animate_image(PyObject *self, PyObject *args, PyObject *kwds)
     return NULL;    
 }
 
-static char doc_copy_image[] = "copy an image to another image";
+/* Pixel caches that img.view() arrays point into.  Each array holds a
+   pin: a clone of its frame that shares the frame's cache, so the
+   memory lives as long as the array.  Holding the second reference also
+   means the next write through the image itself copies the cache first
+   (the view keeps the old pixels) instead of reopening the one the
+   array points into. */
+typedef struct _ViewPin {
+    Image *image;
+    struct _ViewPin *next;
+} ViewPin;
+
+static ViewPin *_viewpins = NULL;
+
+static int
+frame_has_view(const Image *image)
+{
+    ViewPin *pin;
+
+    for (pin=_viewpins; pin; pin=pin->next)
+        if (pin->image->cache == image->cache) return True;
+    return False;
+}
+
+/* Clone count frames starting at image (all of them if count < 0) into
+   a new list.  CloneImage() with a zero size shares the pixel cache,
+   which GraphicsMagick reference-counts and copies only on the first
+   write through one of the sharers, so this copies frame headers, not
+   pixels.  The clones are linked as they are made; appending them one
+   at a time would walk the list each time. */
+static Image *
+share_frames(const Image *image, long count, ExceptionInfo *exception)
+{
+    Image *head=NULL, *tail=NULL, *clone;
+
+    for (; (image != NULL) && (count != 0); image=image->next, count--) {
+        clone = CloneImage(image, 0, 0, True, exception);
+        /* A frame with a view gets its own pixels: the array writes
+           straight into the cache, past the copy-on-write check */
+        if ((clone != NULL) && frame_has_view(image) &&
+            ((GetImagePixels(clone, 0, 0, 1, 1) == NULL) ||
+             !SyncImagePixels(clone))) {
+            ThrowException(exception, ResourceLimitError, 
+                           "Could not copy the pixels of a viewed frame",
+                           clone->exception.reason);
+            DestroyImage(clone);
+            clone = NULL;
+        }
+        if (clone == NULL) {
+            if (head) DestroyImageList(head);
+            return NULL;
+        }
+        clone->previous = tail;
+        clone->next = NULL;
+        if (tail) tail->next = clone;
+        else head = clone;
+        tail = clone;
+    }
+    return head;
+}
+
+static char doc_copy_image[] = "copy an image to another image\n\n"\
+" The frames share pixels with img until one of them is changed.";
 static PyObject *
 copy_image(PyObject *self)
 {
     PyMImageObject *obj=NULL;
-    
-    obj = PyObject_New(PyMImageObject, &MImage_Type);
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+    obj = mimage_alloc();
     if (obj == NULL) return NULL;
     obj->ims = NULL;
 
-    obj->ims = CloneImageList(ASIM(self)->ims, &exception);
+    obj->ims = share_frames(ASIM(self)->ims, -1, &exception);
     CHECK_ERR;
 
     return (PyObject *)obj;
@@ -2018,7 +3218,7 @@ quantize_image(PyObject *self, PyObject *args, PyObject *kwds)
             if (strEQ(tmpstr,"colorspace")) {
                 vstr = PyString_AsString(value);
                 if (vstr==NULL) ERRMSG("Colorspace must be valid string");
-                if ((ind = LookupStr(ColorspaceTypes, vstr)) < 0)
+                if ((ind = lookup_colorspace(vstr)) < 0)
                     ERRMSG("Invalid colorspace.");
                 qinfo->colorspace = (ColorspaceType) ind;
             }
@@ -2103,23 +3303,129 @@ get_colormap(Image *im)
 }
 
 
+/* One row band of an exported frame for run_row_bands().  For index
+   frames channels is the size of one output index in bytes. */
+typedef struct {
+    const PixelPacket *pixels;
+    const IndexPacket *indexes;
+    char *q;
+    long columns;
+    int channels;
+} ExportBand;
+
+/* Array type for the colormap indexes of a palette with colors entries */
+#define INDEX_ARRAYTYPE(colors) \
+    ((colors) > 256 ? PyArray_USHORT : PyArray_UBYTE)
+
+/* Store count colormap indexes as unsigned bytes (elsize 1) or unsigned
+   shorts (elsize 2) */
+static void
+copy_indexes(const IndexPacket *indexes, char *q, long count, int elsize)
+{
+    register long x;
+
+    if (elsize == 1)
+        for (x=0; x < count; x++)
+            ((unsigned char *) q)[x] = (unsigned char) indexes[x];
+    else
+        for (x=0; x < count; x++)
+            ((unsigned short *) q)[x] = (unsigned short) indexes[x];
+}
+
+static void
+index_band(void *arg, long first, long last)
+{
+    ExportBand *b = (ExportBand *) arg;
+    long offset = first * b->columns;
+
+    copy_indexes(b->indexes + offset, b->q + offset * b->channels,
+                 (last - first) * b->columns, b->channels);
+}
+
+static void
+direct_band(void *arg, long first, long last)
+{
+    ExportBand *b = (ExportBand *) arg;
+    long offset = first * b->columns;
+
+    deinterleave(b->pixels + offset,
+                 (Quantum *) (b->q + offset * b->channels * _qsize),
+                 (last - first) * b->columns, b->channels);
+}
+
+/* Copy the colormap indexes of one frame to q, elsize bytes each, using
+   read-only pixel access.  Runs without the interpreter lock.  Returns 0
+   if the pixel cache failed. */
+static int
+export_index_frame(const Image *im, char *q, int elsize, 
+                   ExceptionInfo *exception)
+{
+    ExportBand b;
+    long y;
+
+    b.pixels = NULL;
+    if (_workers > 1) b.pixels = acquire_frame_pixels(im);
+    if (b.pixels != NULL) {
+        b.indexes = GetIndexes(im);
+        b.q = q;
+        b.columns = (long) im->columns;
+        b.channels = elsize;
+        run_row_bands(index_band, &b, (long) im->rows, b.columns);
+        return 1;
+    }
+    for (y=0; y < (long) im->rows; y++) {
+        if (AcquireImagePixels(im,0,y,im->columns,1,exception) == NULL)
+            return 0;
+        copy_indexes(GetIndexes(im), q, im->columns, elsize);
+        q += im->columns*elsize;
+    }
+    return 1;
+}
+
+/* Deinterleave one frame into q, channels Quantums per pixel.  Runs
+   without the interpreter lock.  Returns 0 if the pixel cache failed. */
+static int
+export_direct_frame(const Image *im, char *q, int channels,
+                    ExceptionInfo *exception)
+{
+    ExportBand b;
+    const PixelPacket *p;
+    long y;
+
+    b.pixels = NULL;
+    if (_workers > 1) b.pixels = acquire_frame_pixels(im);
+    if (b.pixels != NULL) {
+        b.q = q;
+        b.columns = (long) im->columns;
+        b.channels = channels;
+        run_row_bands(direct_band, &b, (long) im->rows, b.columns);
+        return 1;
+    }
+    for (y=0; y < (long) im->rows; y++) {
+        p = AcquireImagePixels(im,0,y,im->columns,1,exception);
+        if (p == NULL) return 0;
+        deinterleave(p, (Quantum *) q, im->columns, channels);
+        q += im->columns*channels*_qsize;
+    }
+    return 1;
+}
+
+
 static PyArrayObject*
 convert_from_palette(Image *im, int type)
 {
     PyArrayObject *arr;
-    register PixelPacket *p;
     int arrdims[2];
     int ret;
     int rawtransfer = 1;
     StorageType stype;
-    long x, y;
     char *ptr;
-    unsigned char *q;
-    IndexPacket *indexes;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     /* Only use ImageMagick's scaling magick for float and double */
     if ((type == PyArray_FLOAT) || (type == PyArray_DOUBLE)) rawtransfer = 0;
-    else type = PyArray_UBYTE;  /* palette images only if colormap is less than 256 */
+    else type = INDEX_ARRAYTYPE(im->colors);
 
     arrdims[0] = im->rows;
     arrdims[1] = im->columns;
@@ -2138,17 +3444,11 @@ convert_from_palette(Image *im, int type)
     /* Else grab pixels from image, determine which color in the colormap they correspond
        to and place that index number in the output array */
 
-    q = (unsigned char *)ptr;
-    for (y=0; y < (long) im->rows; y++) {
-    p = GetImagePixels(im,0,y,im->columns,1);
-    if (p==NULL) break;
-        indexes = GetIndexes(im);
-    for (x=0; x< (long) im->columns; x++) {
-        *q++ = (unsigned char)(indexes[x]);
-        p++;
-    }
-        CHECK_ERR_IM(im);
-    }
+    Py_BEGIN_ALLOW_THREADS
+    ret = export_index_frame(im, ptr, ELSIZE(arr), &exception);
+    Py_END_ALLOW_THREADS
+    CHECK_ERR;
+    if (!ret) ERRMSG("Could not read the image pixels.");
     return arr;
     
  fail:
@@ -2159,22 +3459,28 @@ convert_from_palette(Image *im, int type)
 static PyArrayObject*
 convert_from_palette_sequence(Image *im, int type, int len)
 {
-    PyArrayObject *arr;
-    register PixelPacket *p;
-    IndexPacket *indexes;
+    PyArrayObject *arr=NULL;
+    Image *mag;
     int arrdims[3];
     int ret;
     int rawtransfer = 1;
+    unsigned long colors = 0;
     StorageType stype;
-    long x, y;
     register int k;
     char *ptr;
-    unsigned char *q;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+
+    for (mag=im; mag; mag=mag->next) {
+        if ((mag->columns != im->columns) || (mag->rows != im->rows))
+            ERRMSG("All frames must have the same size.");
+        if (mag->colors > colors) colors = mag->colors;
+    }
 
     /* Only use ImageMagick's scaling magick for float and double */
     if ((type == PyArray_FLOAT) || (type == PyArray_DOUBLE)) rawtransfer = 0;
-    else type = PyArray_UBYTE;  /* palette images only if colormap is less than 256 */
+    else type = INDEX_ARRAYTYPE(colors);
 
     arrdims[0] = len;
     arrdims[1] = im->rows;
@@ -2186,8 +3492,8 @@ convert_from_palette_sequence(Image *im, int type, int len)
     /* Fill up array */
     ptr = DATA(arr);
     if (!rawtransfer) {
-    for (k=0; k< len; k++) {
-        stype = arraytype_to_storagetype(type);
+    stype = arraytype_to_storagetype(type);
+    for (k=0; k < len; k++, im=im->next) {
         ret = DispatchImage(im, 0, 0, arrdims[2], arrdims[1], "I", stype, 
                 (void *)ptr, &exception);
         CHECK_ERR;
@@ -2196,25 +3502,22 @@ convert_from_palette_sequence(Image *im, int type, int len)
     return arr;
     }
 
-    /* Else grab pixels from image, determine which color in the colormap they 
-          correspond to and place that index number in the output array */
-    q = (unsigned char *)ptr;
-    for (k=0; k < len; k++) {
-        for (y=0; y < (long) im->rows; y++) {
-            p = GetImagePixels(im,0,y,im->columns,1);
-            if (p==NULL) break;
-            indexes = GetIndexes(im);
-            for (x=0; x< (long) im->columns; x++) {
-                *q++ = (unsigned char)(indexes[x]);
-                p++;
-            }
-        }
-        CHECK_ERR_IM(im);
+    /* Else copy the colormap indexes of each frame into its slice of the
+       output array */
+    ret = 1;
+    Py_BEGIN_ALLOW_THREADS
+    for (k=0; k < len; k++, im=im->next) {
+        ret = export_index_frame(im, ptr, ELSIZE(arr), &exception);
+        if (!ret) break;
+        ptr += STRIDE(arr,0);
     }
+    Py_END_ALLOW_THREADS
+    CHECK_ERR;
+    if (!ret) ERRMSG("Could not read the image pixels.");
     return arr;
     
  fail:
-    Py_DECREF(arr);
+    Py_XDECREF(arr);
     return NULL;
 }
 
@@ -2223,15 +3526,14 @@ static PyArrayObject*
 convert_from_direct(Image *im, int type)
 {
     PyArrayObject *arr;
-    register const PixelPacket *p;
     int arrdims[3];
     int ret, lastdim;
     int rawtransfer = 1;
     StorageType stype;
-    long x, y;
     char *ptr, *str;
-    char *q;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     /* Only use ImageMagick's scaling magick for float and double */
     if ((type == PyArray_FLOAT) || (type == PyArray_DOUBLE)) rawtransfer = 0;
     else type = ptype;
@@ -2258,25 +3560,11 @@ convert_from_direct(Image *im, int type)
     }
 
     /* Else grab pixels from image and copy them to the output */
-    q = ptr;
-    for (y=0; y < (long) im->rows; y++) {
-    p = AcquireImagePixels(im,0,y,im->columns,1,&exception);
-    if (p==NULL) break;
-    for (x=0; x< (long) im->columns; x++) {
-        memcpy(q, &(p->red), _qsize);
-        q += _qsize;
-        memcpy(q, &(p->green), _qsize);
-        q += _qsize;
-        memcpy(q, &(p->blue), _qsize);
-        q += _qsize;
-        if (lastdim == 4) {
-        memcpy(q, &(p->opacity), _qsize);
-        q += _qsize;
-        }
-        p++;
-    }
-    }
+    Py_BEGIN_ALLOW_THREADS
+    ret = export_direct_frame(im, ptr, lastdim, &exception);
+    Py_END_ALLOW_THREADS
     CHECK_ERR;
+    if (!ret) ERRMSG("Could not read the image pixels.");
     return arr;
     
  fail:
@@ -2290,16 +3578,15 @@ static PyArrayObject*
 convert_from_direct_sequence(Image *im, int type, int len)
 {
     PyArrayObject *arr;
-    register const PixelPacket *p;
     int arrdims[4];
     int ret, lastdim;
     int rawtransfer = 1;
     StorageType stype;
-    long x, y;
     register int k;
     char *ptr, *str;
-    char *q;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     /* Only use ImageMagick's scaling magick for float and double */
     if ((type == PyArray_FLOAT) || (type == PyArray_DOUBLE)) rawtransfer = 0;
     else type = ptype;
@@ -2332,29 +3619,18 @@ convert_from_direct_sequence(Image *im, int type, int len)
     }
 
     /* Else grab pixels from image and copy them to the output */
-    q = ptr;
+    ret = 1;
+    Py_BEGIN_ALLOW_THREADS
     for (k=0; k < len; k++) {
-    if (!im) break;
-    for (y=0; y < (long) im->rows; y++) {
-        p = AcquireImagePixels(im,0,y,im->columns,1,&exception);
-        if (p==NULL) break;
-        for (x=0; x< (long) im->columns; x++) {
-        memcpy(q, &(p->red), _qsize);
-        q += _qsize;
-        memcpy(q, &(p->green), _qsize);
-        q += _qsize;
-        memcpy(q, &(p->blue), _qsize);
-        q += _qsize;
-        if (lastdim == 4) {
-            memcpy(q, &(p->opacity), _qsize);
-            q += _qsize;
-        }
-        p++;
-        }
+        if (!im) break;
+        ret = export_direct_frame(im, ptr, lastdim, &exception);
+        if (!ret) break;
+        ptr += STRIDE(arr,0);
+        im = im->next;
     }
+    Py_END_ALLOW_THREADS
     CHECK_ERR;
-    im = im->next;
-    }
+    if (!ret) ERRMSG("Could not read the image pixels.");
     return arr;
     
  fail:
@@ -2371,7 +3647,7 @@ toarray_image(PyObject *self, PyObject *args)
     PyArrayObject *arr=NULL;
     PyArray_Descr *descr;
     int N, otype;
-    Image *images;
+    Image *images, *mag;
     char atype='b';
 
     if (!PyArg_ParseTuple(args, "|c", &atype)) return NULL;
@@ -2394,7 +3670,9 @@ toarray_image(PyObject *self, PyObject *args)
         Py_INCREF(Py_None);
         return Py_None;
     }
-    if ((images->storage_class==PseudoClass) && (images->colors <= 256)) {
+    for (mag=images; mag; mag=mag->next)
+        if (mag->storage_class != PseudoClass) break;
+    if (mag == NULL) {
     if (N==1) arr = convert_from_palette(images, otype);
     else arr = convert_from_palette_sequence(images, otype, N);
     if (arr==NULL) return NULL;
@@ -2780,7 +4058,9 @@ static char doc_draw_image[] = "img.draw(primitives)\n\n"\
 "   The string will be passed directly to ImageMagick to be used\n"\
 "   in drawing on the image.  primitives can also be a drawing info object.\n"\
 "   Primitives can either draw or set parameters for basic drawing.\n"\
-"   It is like a graphics language.\n";
+"   It is like a graphics language.\n"\
+"   A drawing from dc.compile() is drawn without parsing it again and is\n"\
+"   not cleared; a drawing info object is cleared after drawing.\n";
 static PyObject *
 draw_image(PyObject *self, PyObject *obj)
 {
@@ -2796,6 +4076,10 @@ draw_image(PyObject *self, PyObject *obj)
     "   or a special draw_info object.";
     int dcobj=0;
     
+    if (PyDrawing_Check(obj)) {
+        if (!draw_compiled(obj, ASIM(self)->ims)) return NULL;
+        goto done;
+    }
     if (PyDrawInfo_Check(obj)) {
     primitives = ASDI(obj)->prim;
     current = ASDI(obj)->info;
@@ -2820,13 +4104,14 @@ draw_image(PyObject *self, PyObject *obj)
                 ERRMSG(errm);
         }
     }
-    Py_XDECREF(meth);
-    Py_XDECREF(res);
     if (primitives == NULL) goto done;
         
     draw_info = CloneDrawInfo(NULL, current);
     if (!CloneString(&(draw_info->primitive), primitives))
         ERRMSG("Could not copy primitives to drawing context.");
+    Py_XDECREF(meth);   /* primitives may point into either */
+    Py_XDECREF(res);
+    meth = res = NULL;
     for (mag=ASIM(self)->ims; mag; mag=mag->next) {
     DrawImage(mag, draw_info);
         CHECK_ERR_IM(mag);
@@ -3059,7 +4344,9 @@ colorfloodfill_image(PyObject *self, PyObject *args, PyObject *kwds)
     PixelPacket target, fill;
     DrawInfo *draw_info=NULL;
     PaintMethod method;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (!PyArg_ParseTuple(args, "OOll|i", &tcolor, &fcolor, &xoffset, 
                           &yoffset, &toborder)) return NULL;
 
@@ -3667,7 +4954,7 @@ segment_image(PyObject *self, PyObject *args, PyObject *kwds)
                           &smooth)) return NULL;
 
     if (cspace==NULL) cspace="rgb";
-    if ((ind = LookupStr(ColorspaceTypes, cspace)) < 0)
+    if ((ind = lookup_colorspace(cspace)) < 0)
         ERRMSG3(cspace,"segment");
 
     for (mag=imobj->ims; mag; mag=mag->next) {
@@ -3701,10 +4988,11 @@ index_image(PyObject *self, PyObject *args)
     PixelPacket old_color, *pixel;
     long old_index, index=-1;
     long x,y,z=0;
-    int N, k;
     int get=1;
     IndexPacket *indexes;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
 
     if (!PyArg_ParseTuple(args, "ll|Ol", &x, &y, &z_or_index, &index))
         return NULL;
@@ -3724,11 +5012,10 @@ index_image(PyObject *self, PyObject *args)
         }
     }
 
-    N = GetImageListLength(ASIM(self)->ims);
-    if ((z < 0) || (z >= N))  
+    if ((mag = mimage_frame(ASIM(self), z)) == NULL) {
+        if (PyErr_Occurred()) return NULL;
         ERRMSG("Given value of z is too large for image list.");
-    k = 0;
-    for (mag=ASIM(self)->ims; k < z; mag=mag->next) k++;
+    }
     
     if (mag->storage_class != PseudoClass)
         ERRMSG("getting and setting indexes only works for PseudoClass"\
@@ -3776,9 +5063,10 @@ pixelcolor_image(PyObject *self, PyObject *args)
     PyObject *ncolor=NULL;
     PixelPacket old_color = {0}, new_color, *pixel;
     long x,y,z=0;
-    int N, k;
     int get=1;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
     if (!PyArg_ParseTuple(args, "ll|OO", &x, &y, &z_or_color, &ncolor))
         return NULL;
     
@@ -3796,12 +5084,10 @@ pixelcolor_image(PyObject *self, PyObject *args)
         }
     }
 
-    N = GetImageListLength(ASIM(self)->ims);
-    if ((z < 0) || (z >= N)) 
+    if ((mag = mimage_frame(ASIM(self), z)) == NULL) {
+        if (PyErr_Occurred()) return NULL;
         ERRMSG("Image list to small for given value of z.");
-
-    k = 0;
-    for (mag=ASIM(self)->ims; k < z; mag=mag->next) k++;
+    }
     
     if (get) {     /* get the pixel */
         IndexPacket *indexes;
@@ -3850,14 +5136,15 @@ getpixels_image(PyObject *self, PyObject *args)
 {
     Image *im, *image;
     PixelPacket *pixels;
-    PixelPacket pix;
     long x,y, cols, rows, z=0, imgs=1;
     long size, n;
     long num;
     PyObject *arrobj=NULL;
     int nd, dims[4], ld;
     Quantum* arrptr;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     im = ASIM(self)->ims;
     if (!PyArg_ParseTuple(args, "llll|ll", &x, &y, &cols, &rows, &z,
                           &imgs)) return NULL;
@@ -3868,45 +5155,39 @@ getpixels_image(PyObject *self, PyObject *args)
                      cols, rows, x, y);
         return NULL;
     }
-    num = GetImageListLength(im);
+    num = mimage_frames(ASIM(self));
+    if (num < 0) return NULL;
     if ((z < 0) || (z+imgs > num) || (imgs < 0)) {
         PyErr_Format(PyMagickError,"z = %ld and imgs=%ld not valid", num, imgs);
         return NULL;
     }
     
     /* Create Array to hold pixels in */
+    ld = (im->matte ? 4 : 3);
     if (imgs > 1) { 
         dims[0] = imgs;
         dims[1] = rows;
         dims[2] = cols;
-        if (im->matte) dims[3] = 4;
-        else dims[3] = 3;
+        dims[3] = ld;
         nd = 4;
     }
     else {
         nd = 3; dims[0] = rows; dims[1] = cols;
-        if (im->matte) dims[2] = 4;
-        else dims[2] = 3;
-        dims[3] = 1;
+        dims[2] = ld;
     }    
     arrobj = PyArray_FromDims(nd,dims,ptype);
     if (arrobj == NULL) return NULL;
-    ld = dims[3];
     arrptr = (Quantum *) DATA(arrobj);
     size = rows*cols;
-    for (image = im; image; image=image->next) {
+    image = mimage_frame(ASIM(self), z);
+    for (n = 0; image && (n < imgs); n++, image=image->next) {
         pixels = (PixelPacket *)AcquireImagePixels(image, x, y, cols, rows, 
                                                    &exception);
         CHECK_ERR;
         if (!pixels) ERRMSG("Could not acquire pixels.");
         /* Copy over pixels into output array */
-        for (n=0; n < size; n++) {
-            pix = pixels[n];
-            *arrptr++ = pix.red;
-            *arrptr++ = pix.green;
-            *arrptr++ = pix.blue;
-            if (ld == 4) *arrptr++ = pix.opacity;
-        }
+        deinterleave(pixels, arrptr, size, ld);
+        arrptr += size*ld;
     } 
     return arrobj;    
     
@@ -3916,67 +5197,131 @@ getpixels_image(PyObject *self, PyObject *args)
 }
 
 
+/* Cast the elements of a (rows, cols<, channels>) block of an array into
+   pixel fields.  data points at the first element; the strides come from
+   the array, so slices are read in place.  Values are not rescaled. */
+#define STRIDED_PIXELS(ctype) \
+    for (r=0; r < rows; r++) { \
+        p = data + r*ystride; \
+        for (c=0; c < cols; c++, p+=xstride, q++) { \
+            q->red = (Quantum) *(ctype *)p; \
+            q->green = (Quantum) *(ctype *)(p+cstride); \
+            q->blue = (Quantum) *(ctype *)(p+2*cstride); \
+            if (ld == 4) q->opacity = (Quantum) *(ctype *)(p+3*cstride); \
+        } \
+    }
+
+#define STRIDED_INDEXES(ctype) \
+    for (r=0; r < rows; r++) { \
+        p = data + r*ystride; \
+        for (c=0; c < cols; c++, p+=xstride) \
+            *q++ = (IndexPacket) *(ctype *)p; \
+    }
+
+/* Return obj itself if it is an array setpixels() and setindexes() can
+   read in place (any strides), else a contiguous copy of type ptype.
+   Either way the array has rank lo or hi. */
+static PyArrayObject *
+settable_array(PyObject *obj, int lo, int hi)
+{
+    int type;
+
+    if (PyArray_Check(obj) && (RANK(obj) >= lo) && (RANK(obj) <= hi)) {
+        type = TYPE(obj);
+        if ((type == PyArray_CHAR) || (type == PyArray_UBYTE) ||
+            (type == PyArray_USHORT) || (type == PyArray_UINT) ||
+            (type == PyArray_LONG) || (type == PyArray_FLOAT) ||
+            (type == PyArray_DOUBLE)) {
+            Py_INCREF(obj);
+            return ASARR(obj);
+        }
+    }
+    return ASARR(PyArray_ContiguousFromObject(obj, ptype, lo, hi));
+}
+
 static char doc_setpixels_image[] = \
 "img.setpixels(data<,x,y,z>)\n\n"\
 " Set raw data into the image at offset x,y, z\n"\
-" Default to 0,0,0.  The array shape determines how many pixels to set";
+" Default to 0,0,0.  The array shape determines how many pixels to set:\n"\
+"   (rows, cols, 3 or 4) for frame z, or (imgs, rows, cols, 3 or 4) for\n"\
+"   frames z to z+imgs-1.  Array slices are read without a copy.";
 static PyObject*
 setpixels_image(PyObject *self, PyObject *args)
 {
-    Image *im, *image;
-    PixelPacket *pixels;
-    PixelPacket *pix;
+    Image *image;
+    PixelPacket *q;
     long x=0,y=0, cols, rows, z=0, imgs=1;
-    long size, n;
+    long n, r, c;
     long num;
-    PyObject *obj, *arrobj=NULL, *tmp=NULL;
-    int nd, ld;
-    Quantum* arrptr;
+    PyObject *obj;
+    PyArrayObject *arrobj=NULL;
+    int nd, ld, xstride, ystride, cstride;
+    char *data, *p;
     
-    im = ASIM(self)->ims;
     if (!PyArg_ParseTuple(args, "O|lll", &obj, &x, &y, &z))
         return NULL;
     
-    num = GetImageListLength(im);
-    if (num > 1) nd = 4;
-    else nd = 3;
-    arrobj = PyArray_ContiguousFromObject(obj, PyArray_NOTYPE,nd,nd);
+    num = mimage_frames(ASIM(self));
+    if (num < 0) return NULL;
+    arrobj = settable_array(obj, 3, 4);
     if (arrobj == NULL) return NULL;
-    tmp = PyArray_Cast((PyArrayObject *)arrobj, ptype);
-    Py_DECREF(arrobj);
-    arrobj = tmp;
-    if (arrobj==NULL) return NULL;
 
+    nd = RANK(arrobj);
     cols = DIM(arrobj,nd-2);
     rows = DIM(arrobj,nd-3);
     imgs = (nd==3) ? 1 : DIM(arrobj,0);
+    ld = DIM(arrobj,nd-1);
+    if ((ld != 3) && (ld != 4)) ERRMSG("Data must have 3 or 4 channels.");
 
-    if ((x+cols > im->columns) || (y+rows > im->rows) || \
-        (cols < 0) || (rows < 0)) {
-        PyErr_Format(PyMagickError,"goemetry (%lux%lu%+ld%+ld) exceeds image bounds",
-                     cols, rows, x, y);
-        return NULL;
-    }
     if ((z < 0) || (z+imgs > num) || (imgs <= 0)) {
         PyErr_Format(PyMagickError,"z = %ld and imgs=%ld not valid", num, imgs);
-        return NULL;
+        goto fail;
     }
     
-    ld = DIM(arrobj,nd-1);
-    arrptr = (Quantum *) DATA(arrobj);
-    size = rows*cols;
-    for (image = im; image; image=image->next) {
-        if (ld == 4) SetImageType(image, TrueColorMatteType);
-        else SetImageType(image, TrueColorType);
-        pixels = SetImagePixels(image, x, y, cols, rows);
-        if (!pixels) ERRMSG("Could not acquire pixels.");
+    ystride = STRIDE(arrobj,nd-3);
+    xstride = STRIDE(arrobj,nd-2);
+    cstride = STRIDE(arrobj,nd-1);
+    image = mimage_frame(ASIM(self), z);
+    for (n = 0; n < imgs; n++, image=image->next) {
+        if ((x < 0) || (y < 0) || (x+cols > image->columns) || 
+            (y+rows > image->rows)) {
+            PyErr_Format(PyMagickError,"goemetry (%lux%lu%+ld%+ld) exceeds image bounds",
+                         cols, rows, x, y);
+            goto fail;
+        }
+        if ((ld == 4) && !image->matte) 
+            SetImageType(image, TrueColorMatteType);
+        else if (image->storage_class != DirectClass)
+            SetImageType(image, image->matte ? TrueColorMatteType : 
+                         TrueColorType);
+        /* RGB data leaves the opacity of a matte frame alone, so fetch
+           the pixels being overwritten (SetImagePixels() does not) */
+        if ((ld == 3) && image->matte)
+            q = GetImagePixels(image, x, y, cols, rows);
+        else q = SetImagePixels(image, x, y, cols, rows);
+        if (!q) ERRMSG("Could not acquire pixels.");
         /* Copy over pixels from array */
-        for (n=0; n < size; n++) {
-            pix = pixels++;
-            pix->red = *arrptr++;
-            pix->green = *arrptr++;
-            pix->blue = *arrptr++;
-            if (ld == 4) pix->opacity = *arrptr++;
+        data = DATA(arrobj) + ((nd == 4) ? n*STRIDE(arrobj,0) : 0);
+        switch (TYPE(arrobj)) {
+        case PyArray_CHAR:
+        case PyArray_UBYTE:
+            STRIDED_PIXELS(unsigned char);
+            break;
+        case PyArray_USHORT:
+            STRIDED_PIXELS(unsigned short);
+            break;
+        case PyArray_UINT:
+            STRIDED_PIXELS(unsigned int);
+            break;
+        case PyArray_LONG:
+            STRIDED_PIXELS(long);
+            break;
+        case PyArray_FLOAT:
+            STRIDED_PIXELS(float);
+            break;
+        case PyArray_DOUBLE:
+            STRIDED_PIXELS(double);
+            break;
         }
         if (!SyncImagePixels(image)) ERRMSG("Could not sync image pixels.");
     }
@@ -3997,33 +5342,43 @@ static char doc_getindexes_image[] = \
 static PyObject *
 getindexes_image(PyObject *self, PyObject *args)
 {
-    Image *im, *image;
+    Image *image;
     IndexPacket *indexes;
     PixelPacket *pixels;
     long x,y, cols, rows, z=0, imgs=1;
-    long size, n;
+    long size, n, k;
     long num;
     PyObject *arrobj=NULL;
     int nd, dims[3];
     Quantum* arrptr;
-    
-    im = ASIM(self)->ims;
-    if (im->storage_class != PseudoClass)
-        ERRMSG("getindexes only works with PseudoClass arrays.");
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
     if (!PyArg_ParseTuple(args, "llll|ll", &x, &y, &cols, &rows, &z,
                           &imgs)) return NULL;
     
-    if ((x+cols > im->columns) || (y+rows > im->rows) || \
-        (cols < 0) || (rows < 0)) {
+    num = mimage_frames(ASIM(self));
+    if (num < 0) return NULL;
+    if ((z < 0) || (z+imgs > num) || (imgs < 0)) {
+        PyErr_Format(PyMagickError,"z = %ld and imgs=%ld not valid", z, imgs);
+        return NULL;
+    }
+    if ((x < 0) || (y < 0) || (cols < 0) || (rows < 0)) {
         PyErr_Format(PyMagickError,"goemetry (%lux%lu%+ld%+ld) exceeds image bounds",
                      cols, rows, x, y);
         return NULL;
     }
-    num = GetImageListLength(im);
-    if ((z < 0) || (z+imgs > num) || (imgs < 0)) {
-        PyErr_Format(PyMagickError,"z = %ld and imgs=%ld not valid", num, imgs);
-        return NULL;
+    /* Every frame read must be a palette image and hold the rectangle */
+    image = mimage_frame(ASIM(self), z);
+    for (n = 0; image && (n < imgs); n++, image=image->next) {
+        if (image->storage_class != PseudoClass)
+            ERRMSG("getindexes only works with PseudoClass arrays.");
+        if ((x+cols > (long) image->columns) || 
+            (y+rows > (long) image->rows)) {
+            PyErr_Format(PyMagickError,"goemetry (%lux%lu%+ld%+ld) exceeds "
+                         "the bounds of image %ld", cols, rows, x, y, z+n);
+            return NULL;
+        }
     }
     
     /* Create Array to hold pixels in */
@@ -4041,15 +5396,17 @@ getindexes_image(PyObject *self, PyObject *args)
     if (arrobj == NULL) return NULL;
     arrptr = (Quantum *) DATA(arrobj);
     size = rows*cols;
-    for (image = im; image; image=image->next) {
+    image = mimage_frame(ASIM(self), z);
+    for (n = 0; image && (n < imgs); n++, image=image->next) {
         pixels = (PixelPacket *)AcquireImagePixels(image, x, y, cols, rows, 
                                                    &exception);
         CHECK_ERR;
         if (!pixels) ERRMSG("Could not acquire pixels.");
         indexes = GetIndexes(image);
+        if (!indexes) ERRMSG("Could not acquire indexes.");
         /* Copy over pixels index values into output array */
-        for (n=0; n < size; n++) {
-            *arrptr++ = indexes[n];
+        for (k=0; k < size; k++) {
+            *arrptr++ = indexes[k];
         }
     } 
     return arrobj;
@@ -4061,64 +5418,80 @@ getindexes_image(PyObject *self, PyObject *args)
 
 
 static char doc_setindexes_image[] = \
-"img.setpixels(data<,x,y,z>)\n\n"\
+"img.setindexes(data<,x,y,z>)\n\n"\
 " Set raw data into the image at offset x,y,z\n"\
-" Default to 0,0,0.  The array shape determines how many pixels to set";
+" Default to 0,0,0.  The array shape determines how many pixels to set:\n"\
+"   (rows, cols) for frame z, or (imgs, rows, cols) for frames z to\n"\
+"   z+imgs-1.  Array slices are read without a copy.";
 static PyObject*
 setindexes_image(PyObject *self, PyObject *args)
 {
-    Image *im, *image;
-    IndexPacket *indexes;
-    PixelPacket *pixels;
+    Image *image;
+    IndexPacket *q;
     long x=0,y=0, cols, rows, z=0, imgs=1;
-    long size, n;
+    long n, r, c;
     long num;
-    PyObject *obj, *arrobj=NULL, *tmp=NULL;
-    int nd;
-    Quantum* arrptr;
+    PyObject *obj;
+    PyArrayObject *arrobj=NULL;
+    int nd, xstride, ystride;
+    char *data, *p;
     
-    im = ASIM(self)->ims;
-    if (im->storage_class != PseudoClass)
-        ERRMSG("getindexes only works with PseudoClass arrays.");
-
     if (!PyArg_ParseTuple(args, "O|lll", &obj, &x, &y, &z))
         return NULL;
     
-    num = GetImageListLength(im);
-    if (num > 1) nd = 3;
-    else nd = 2;
-    arrobj = PyArray_ContiguousFromObject(obj, PyArray_NOTYPE,nd,nd);
+    num = mimage_frames(ASIM(self));
+    if (num < 0) return NULL;
+    arrobj = settable_array(obj, 2, 3);
     if (arrobj == NULL) return NULL;
-    tmp = PyArray_Cast((PyArrayObject *)arrobj, ptype);
-    Py_DECREF(arrobj);
-    arrobj = tmp;
-    if (arrobj==NULL) return NULL;
 
+    nd = RANK(arrobj);
     cols = DIM(arrobj,nd-1);
     rows = DIM(arrobj,nd-2);
     imgs = (nd==2) ? 1 : DIM(arrobj,0);
 
-    if ((x+cols > im->columns) || (y+rows > im->rows) || \
-        (cols < 0) || (rows < 0)) {
-        PyErr_Format(PyMagickError,"goemetry (%lux%lu%+ld%+ld) exceeds image bounds",
-                     cols, rows, x, y);
-        return NULL;
-    }
     if ((z < 0) || (z+imgs > num) || (imgs <= 0)) {
         PyErr_Format(PyMagickError,"z = %ld and imgs=%ld not valid", num, imgs);
-        return NULL;
+        goto fail;
     }
     
-    arrptr = (Quantum *) DATA(arrobj);
-    size = rows*cols;
-    for (image = im; image; image=image->next) {
-        pixels = SetImagePixels(image, x, y, cols, rows);
-        if (!pixels) ERRMSG("Could not acquire pixels.");
+    ystride = STRIDE(arrobj,nd-2);
+    xstride = STRIDE(arrobj,nd-1);
+    image = mimage_frame(ASIM(self), z);
+    for (n = 0; n < imgs; n++, image=image->next) {
+        if (image->storage_class != PseudoClass)
+            ERRMSG("setindexes only works with PseudoClass images.");
+        if ((x < 0) || (y < 0) || (x+cols > image->columns) || 
+            (y+rows > image->rows)) {
+            PyErr_Format(PyMagickError,"goemetry (%lux%lu%+ld%+ld) exceeds image bounds",
+                         cols, rows, x, y);
+            goto fail;
+        }
+        if (!SetImagePixels(image, x, y, cols, rows)) 
+            ERRMSG("Could not acquire pixels.");
         /* Copy over pixels from array */
-        indexes = GetIndexes(image);
-        if (!indexes) ERRMSG("Could not get indexes.")
-        for (n=0; n < size; n++) {
-            indexes[n] = *arrptr++;
+        q = GetIndexes(image);
+        if (!q) ERRMSG("Could not get indexes.")
+        data = DATA(arrobj) + ((nd == 3) ? n*STRIDE(arrobj,0) : 0);
+        switch (TYPE(arrobj)) {
+        case PyArray_CHAR:
+        case PyArray_UBYTE:
+            STRIDED_INDEXES(unsigned char);
+            break;
+        case PyArray_USHORT:
+            STRIDED_INDEXES(unsigned short);
+            break;
+        case PyArray_UINT:
+            STRIDED_INDEXES(unsigned int);
+            break;
+        case PyArray_LONG:
+            STRIDED_INDEXES(long);
+            break;
+        case PyArray_FLOAT:
+            STRIDED_INDEXES(float);
+            break;
+        case PyArray_DOUBLE:
+            STRIDED_INDEXES(double);
+            break;
         }
         if (!SyncImagePixels(image)) ERRMSG("Could not sync image pixels.");
     }
@@ -4132,17 +5505,302 @@ setindexes_image(PyObject *self, PyObject *args)
 }
 
 
+/* Convert xs and ys to long arrays of the same length, check every point
+   against the frame size and return frame z, or NULL with an exception
+   set.  The caller owns *xs and *ys in either case. */
+static Image *
+points_frame(PyObject *self, PyObject *xobj, PyObject *yobj, long z,
+             PyArrayObject **xs, PyArrayObject **ys)
+{
+    Image *mag;
+    long k, n, *xp, *yp;
+
+    *xs = (PyArrayObject *) PyArray_ContiguousFromObject(xobj, PyArray_LONG,
+                                                         1, 1);
+    *ys = (PyArrayObject *) PyArray_ContiguousFromObject(yobj, PyArray_LONG,
+                                                         1, 1);
+    if ((*xs == NULL) || (*ys == NULL)) return NULL;
+    n = DIM(*xs,0);
+    if (DIM(*ys,0) != n) ERRMSG("xs and ys must have the same length.");
+    if ((mag = mimage_frame(ASIM(self), z)) == NULL) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyMagickError, 
+                            "Image list to small for given value of z.");
+        goto fail;
+    }
 
+    xp = (long *) DATA(*xs);
+    yp = (long *) DATA(*ys);
+    for (k=0; k < n; k++) {
+        if ((xp[k] < 0) || (xp[k] >= (long) mag->columns) ||
+            (yp[k] < 0) || (yp[k] >= (long) mag->rows)) {
+            PyErr_Format(PyMagickError, "point %ld (%ld,%ld) is outside "
+                         "the image", k, xp[k], yp[k]);
+            return NULL;
+        }
+    }
+    return mag;
 
-static PyMethodDef image_methods[] = {
-    {"write",  (PyCFunction)write_image, METH_VARARGS|METH_KEYWORDS, 
-     doc_write_image},
-    {"display",  (PyCFunction)display_image, METH_VARARGS|METH_KEYWORDS, 
-     doc_display_image},
-    {"animate",  (PyCFunction)animate_image, METH_VARARGS|METH_KEYWORDS, 
-     doc_animate_image},
-    {"quantize",  (PyCFunction)quantize_image, METH_VARARGS|METH_KEYWORDS, 
-     doc_quantize_image},
+ fail:
+    return NULL;
+}
+
+static char doc_pixels_at_image[] = \
+"colors = img.pixels_at(xs, ys<, z>)\n\n"\
+" Gets the colors of the pixels at (xs[k], ys[k]) of image z (default 0)\n"\
+"   in one call.  Returns an array of shape (len(xs), 4) holding the red,\n"\
+"   green, blue and opacity that img.pixel(x, y, z) gives for each point.";
+static PyObject *
+pixels_at_image(PyObject *self, PyObject *args)
+{
+    Image *mag;
+    PyObject *xobj, *yobj;
+    PyArrayObject *xs=NULL, *ys=NULL, *out=NULL;
+    const PixelPacket *pixels, *p;
+    const IndexPacket *indexes = NULL;
+    PixelPacket color;
+    long k, n, z=0, *xp, *yp;
+    int dims[2];
+    register Quantum *q;
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+    if (!PyArg_ParseTuple(args, "OO|l", &xobj, &yobj, &z)) return NULL;
+    mag = points_frame(self, xobj, yobj, z, &xs, &ys);
+    if (mag == NULL) goto fail;
+
+    n = DIM(xs,0);
+    dims[0] = n;
+    dims[1] = 4;
+    out = (PyArrayObject *) PyArray_FromDims(2, dims, ptype);
+    if (out == NULL) goto fail;
+    xp = (long *) DATA(xs);
+    yp = (long *) DATA(ys);
+    q = (Quantum *) DATA(out);
+
+    Py_BEGIN_ALLOW_THREADS
+    /* Gather straight from an in-memory cache, else one pixel at a time */
+    pixels = acquire_frame_pixels(mag);
+    if ((pixels != NULL) && (mag->storage_class == PseudoClass))
+        indexes = GetIndexes(mag);
+    for (k=0; k < n; k++) {
+        if (indexes != NULL)
+            color = mag->colormap[indexes[yp[k]*mag->columns + xp[k]]];
+        else if (pixels != NULL)
+            color = pixels[yp[k]*mag->columns + xp[k]];
+        else {
+            p = AcquireImagePixels(mag, xp[k], yp[k], 1, 1, &exception);
+            if (p == NULL) break;
+            color = *p;
+            if (mag->storage_class == PseudoClass)
+                color = mag->colormap[*GetIndexes(mag)];
+        }
+        if (!mag->matte) color.opacity = OpaqueOpacity;
+        *q++ = color.red;
+        *q++ = color.green;
+        *q++ = color.blue;
+        *q++ = color.opacity;
+    }
+    Py_END_ALLOW_THREADS
+    CHECK_ERR;
+    if (k < n) ERRMSG("Could not acquire pixels.");
+    Py_DECREF(xs);
+    Py_DECREF(ys);
+    return (PyObject *) out;
+
+ fail:
+    Py_XDECREF(xs);
+    Py_XDECREF(ys);
+    Py_XDECREF(out);
+    return NULL;
+}
+
+
+static char doc_set_pixels_at_image[] = \
+"img.set_pixels_at(xs, ys, colors<, z>)\n\n"\
+" Sets the pixels at (xs[k], ys[k]) of image z (default 0) to colors[k]\n"\
+"   in one call.  colors has shape (len(xs), 3) or (len(xs), 4), or is a\n"\
+"   single color of 3 or 4 values used for every point.  The image is\n"\
+"   made DirectClass first (with opacity if colors has 4 values).  If a\n"\
+"   point is repeated the last color given for it wins.";
+static PyObject *
+set_pixels_at_image(PyObject *self, PyObject *args)
+{
+    Image *mag;
+    PyObject *xobj, *yobj, *cobj;
+    PyArrayObject *xs=NULL, *ys=NULL, *colors=NULL;
+    PixelPacket *pixels, *p;
+    long k, n, z=0, *xp, *yp;
+    int ld, step;
+    register const Quantum *c;
+
+    if (!PyArg_ParseTuple(args, "OOO|l", &xobj, &yobj, &cobj, &z)) 
+        return NULL;
+    mag = points_frame(self, xobj, yobj, z, &xs, &ys);
+    if (mag == NULL) goto fail;
+    n = DIM(xs,0);
+    colors = (PyArrayObject *) PyArray_ContiguousFromObject(cobj, ptype, 
+                                                            1, 2);
+    if (colors == NULL) goto fail;
+    ld = DIM(colors, RANK(colors)-1);
+    if ((ld != 3) && (ld != 4)) 
+        ERRMSG("Colors must have 3 or 4 values.");
+    if ((RANK(colors) == 2) && (DIM(colors,0) != n))
+        ERRMSG("There must be one color per point.");
+    step = (RANK(colors) == 2) ? ld : 0;
+
+    if ((mag->storage_class != DirectClass) || ((ld == 4) && !mag->matte))
+        SetImageType(mag, ((ld == 4) || mag->matte) ? TrueColorMatteType :
+                     TrueColorType);
+    xp = (long *) DATA(xs);
+    yp = (long *) DATA(ys);
+    c = (const Quantum *) DATA(colors);
+
+    Py_BEGIN_ALLOW_THREADS
+    /* Scatter straight into an in-memory cache, else one pixel at a time */
+    pixels = get_frame_pixels(mag);
+    for (k=0; k < n; k++, c+=step) {
+        if (pixels != NULL) p = pixels + yp[k]*mag->columns + xp[k];
+        else if ((p = GetImagePixels(mag, xp[k], yp[k], 1, 1)) == NULL) 
+            break;
+        p->red = c[0];
+        p->green = c[1];
+        p->blue = c[2];
+        p->opacity = (ld == 4) ? c[3] : OpaqueOpacity;
+        if ((pixels == NULL) && !SyncImagePixels(mag)) break;
+    }
+    if ((pixels != NULL) && !SyncImagePixels(mag)) k = -1;
+    Py_END_ALLOW_THREADS
+    if (k < n) {
+        CHECK_ERR_IM(mag);
+        ERRMSG("Could not sync image pixels.");
+    }
+    Py_DECREF(xs);
+    Py_DECREF(ys);
+    Py_DECREF(colors);
+    Py_INCREF(Py_None);
+    return Py_None;
+
+ fail:
+    Py_XDECREF(xs);
+    Py_XDECREF(ys);
+    Py_XDECREF(colors);
+    return NULL;
+}
+
+
+static void
+release_view_pin(void *ptr)
+{
+    ViewPin **link, *pin = (ViewPin *) ptr;
+
+    for (link=&_viewpins; *link; link=&(*link)->next)
+        if (*link == pin) {
+            *link = pin->next;
+            break;
+        }
+    DestroyImage(pin->image);
+    PyMem_Free(pin);
+}
+
+static char doc_view_image[] = \
+"arr = img.view(<z, opacity>)\n\n"\
+" Return a writable array sharing memory with the pixel cache of image z\n"\
+"   (default 0).  No pixels are copied.  The shape is (rows, columns, 3)\n"\
+"   in red, green, blue order.  If opacity is true, the shape is\n"\
+"   (rows, columns, 4) in the memory order given by magick.pixelorder.\n"\
+"   The image is made DirectClass first.  The array keeps its pixels\n"\
+"   alive.  Writes through the array show in img (and in copies made\n"\
+"   before the view) until img itself is changed; from then on img has\n"\
+"   pixels of its own and the array keeps the old ones.  Copies made\n"\
+"   while the view exists get their own pixels.";
+static PyObject *
+view_image(PyObject *self, PyObject *args)
+{
+    Image *im;
+    PixelPacket *pixels;
+    PyObject *arrobj=NULL, *cobj=NULL;
+    ViewPin *pin=NULL;
+    long z=0;
+    int opacity=0, dims[3];
+    char *data;
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+    if (!PyArg_ParseTuple(args, "|li", &z, &opacity)) return NULL;
+    if (z < 0) ERRMSG("z must be >= 0.");
+    if ((im = mimage_frame(ASIM(self), z)) == NULL) {
+        if (PyErr_Occurred()) return NULL;
+        ERRMSG("z is larger than the number of images.");
+    }
+    if (!opacity && (_rgbstride == 0))
+        ERRMSG("No strided RGB view for this PixelPacket layout; use opacity=1.");
+
+    if (im->storage_class != DirectClass)
+        SetImageType(im, im->matte ? TrueColorMatteType : TrueColorType);
+    pixels = get_frame_pixels(im);
+    if (pixels == NULL) {
+        CHECK_ERR_IM(im);
+        ERRMSG("view needs an in-memory pixel cache.");
+    }
+
+    dims[0] = im->rows;
+    dims[1] = im->columns;
+    dims[2] = opacity ? 4 : 3;
+    data = opacity ? (char *)pixels : (char *)&(pixels->red);
+    arrobj = PyArray_FromDimsAndData(3, dims, ptype, data);
+    if (arrobj == NULL) return NULL;
+    STRIDE(arrobj,0) = im->columns*sizeof(PixelPacket);
+    STRIDE(arrobj,1) = sizeof(PixelPacket);
+    STRIDE(arrobj,2) = opacity ? (int) _qsize : _rgbstride;
+    if (!opacity || (sizeof(PixelPacket) != 4*_qsize)) 
+        ASARR(arrobj)->flags &= ~CONTIGUOUS;
+
+    /* Pin the pixel cache (not the frame) for the lifetime of the array */
+    pin = PyMem_New(ViewPin, 1);
+    if (pin == NULL) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    pin->image = CloneImage(im, 0, 0, True, &exception);
+    if (pin->image == NULL) {
+        CHECK_ERR;
+        ERRMSG("Could not pin the pixel cache.");
+    }
+    pin->next = _viewpins;
+    _viewpins = pin;
+    cobj = PyCObject_FromVoidPtr(pin, release_view_pin);
+    if (cobj == NULL) {
+        release_view_pin(pin);
+        pin = NULL;
+        goto fail;
+    }
+    ASARR(arrobj)->base = cobj;
+    return arrobj;
+
+ fail:
+    Py_XDECREF(arrobj);
+    if (pin && !cobj) {
+        if (pin->image) DestroyImage(pin->image);
+        PyMem_Free(pin);
+    }
+    return NULL;
+}
+
+
+
+
+static PyMethodDef image_methods[] = {
+    {"write",  (PyCFunction)write_image, METH_VARARGS|METH_KEYWORDS, 
+     doc_write_image},
+    {"tobytes", (PyCFunction)tobytes_image, METH_VARARGS|METH_KEYWORDS, 
+     doc_tobytes_image},
+    {"display",  (PyCFunction)display_image, METH_VARARGS|METH_KEYWORDS, 
+     doc_display_image},
+    {"animate",  (PyCFunction)animate_image, METH_VARARGS|METH_KEYWORDS, 
+     doc_animate_image},
+    {"quantize",  (PyCFunction)quantize_image, METH_VARARGS|METH_KEYWORDS, 
+     doc_quantize_image},
     {"segment",  (PyCFunction)segment_image, METH_VARARGS|METH_KEYWORDS, 
      doc_segment_image},
     {"compresscolormap", (PyCFunction)compresscolormap_image, METH_NOARGS, 
@@ -4212,6 +5870,11 @@ static PyMethodDef image_methods[] = {
      doc_getindexes_image},
     {"setindexes", (PyCFunction)setindexes_image, METH_VARARGS, 
      doc_setindexes_image},
+    {"pixels_at", (PyCFunction)pixels_at_image, METH_VARARGS, 
+     doc_pixels_at_image},
+    {"set_pixels_at", (PyCFunction)set_pixels_at_image, METH_VARARGS, 
+     doc_set_pixels_at_image},
+    {"view", (PyCFunction)view_image, METH_VARARGS, doc_view_image},
     {NULL, NULL, 0, NULL}    /* sentinel */
 };
 
@@ -4222,7 +5885,9 @@ mimageattr_get(Image *im, char *name)
     PyObject *obj;
     int j;
     long num;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
     switch(*name) {
     case 'b':
       if (strcmp(name, "background")==0) {
@@ -4263,7 +5928,7 @@ mimageattr_get(Image *im, char *name)
     else if (strcmp(name, "clip_mask")==0) {
             if (im->clip_mask == (Image *)NULL)
                 ClipImage(im);
-            obj = (PyObject *)PyObject_New(PyMImageObject, &MImage_Type);
+            obj = (PyObject *)mimage_alloc();
             if (obj == NULL) return NULL;
             ((PyMImageObject *)obj)->ims = \
                 im->clip_mask ? CloneImage(im->clip_mask,0,0,True,&exception) : NULL;
@@ -4639,7 +6304,8 @@ mimage_getattr(PyMImageObject *obj, char *name)
 {
     PyObject *methobj;
     methobj = Py_FindMethod(image_methods, (PyObject *)obj, name);
-    if (methobj != NULL) return methobj;
+    if (methobj != NULL) 
+        return _statson ? stats_bind(methobj, (PyObject *)obj) : methobj;
     /* no method found.  Let's look for attributes. */
     if (PyErr_Occurred()) PyErr_Clear();  
                    /* Get rid of any error from FindMethod */
@@ -4769,7 +6435,7 @@ mimage_setattr(PyMImageObject *obj, char *name, PyObject *v)
         else if (strcmp(name, "colorspace") == 0) {
             tmpstr = PyString_AsString(v);
             if (tmpstr==NULL) return -1;
-            if ((j = LookupStr(ColorspaceTypes, tmpstr)) < 0)
+            if ((j = lookup_colorspace(tmpstr)) < 0)
                 ERRMSG3(tmpstr,name);
             for (image=im ; image; image=image->next) {
                 RGBTransformImage(image, (ColorspaceType) j);
@@ -5147,7 +6813,7 @@ mimage_repr(PyMImageObject *self)
 static Py_ssize_t
 mimage_length(PyMImageObject *self)
 {
-    return GetImageListLength(self->ims);
+    return mimage_frames(self);
 }
 
 static PyObject *
@@ -5155,7 +6821,9 @@ mimage_concat(PyMImageObject *a, PyObject *bb)
 {
     PyMImageObject *new=NULL;
     Image *ca=NULL, *cb=NULL;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (!PyMImage_Check(bb)) {
         PyErr_Format(PyExc_TypeError, 
                      "can only concatenate MImage (not \"%.200s\") to MImage",
@@ -5164,10 +6832,11 @@ mimage_concat(PyMImageObject *a, PyObject *bb)
     }
     
 #define b ((PyMImageObject *)bb)
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    ca = CloneImageList(a->ims, &exception);
-    cb = CloneImageList(b->ims, &exception);
+    new->ims = NULL;
+    ca = share_frames(a->ims, -1, &exception);
+    cb = share_frames(b->ims, -1, &exception);
     CHECK_ERR;
     
     AppendImageToList(&ca,cb);
@@ -5186,7 +6855,9 @@ static PyObject *
 mimage_inplace_concat(PyMImageObject *self, PyObject *bb)
 {
     Image *cb=NULL;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (!PyMImage_Check(bb)) {
         PyErr_Format(PyExc_TypeError, 
                      "can only concatenate MImage (not \"%.200s\") to MImage",
@@ -5195,10 +6866,11 @@ mimage_inplace_concat(PyMImageObject *self, PyObject *bb)
     }
     
 #define b ((PyMImageObject *)bb)
-    cb = CloneImageList(b->ims, &exception);
+    cb = share_frames(b->ims, -1, &exception);
     CHECK_ERR;
     
     AppendImageToList(&(self->ims),cb);
+    mimage_changed(self);
     Py_INCREF(self);
     return (PyObject *)self;
 #undef b
@@ -5208,26 +6880,49 @@ mimage_inplace_concat(PyMImageObject *self, PyObject *bb)
     return NULL;
 }
 
+/* Append n-1 more copies of the frames of list, sharing their pixels.
+   tail is the last frame of list.  Only the original frames are copied,
+   not the copies appended by earlier passes. */
+static int
+repeat_frames(Image *list, Image *tail, int n, ExceptionInfo *exception)
+{
+    Image *ca;
+    long nframes;
+    int i;
+
+    nframes = (long) GetImageListLength(list);
+    for (i=1; i<n; i++) {
+        ca = share_frames(list, nframes, exception);
+        if (ca == NULL) return False;
+        tail->next = ca;
+        ca->previous = tail;
+        tail = GetLastImageInList(ca);
+    }
+    return True;
+}
+
 static PyObject *
 mimage_repeat(PyMImageObject *a, int n)
 {
-    int i; 
     PyMImageObject *new=NULL;
-    Image *ca=NULL, *cnew=NULL;
+    Image *cnew=NULL;
+    ExceptionInfo exception;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    GetExceptionInfo(&exception);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    for (i=0; i<n; i++) {
-        ca = CloneImageList(a->ims, &exception);
+    new->ims = NULL;
+    if ((n > 0) && (a->ims != NULL)) {
+        cnew = share_frames(a->ims, -1, &exception);
+        if (cnew != NULL)
+            repeat_frames(cnew, GetLastImageInList(cnew), n, &exception);
         CHECK_ERR;
-        AppendImageToList(&cnew,ca);
     }
     new->ims = cnew;
     return (PyObject *)new;    
 
  fail: 
     Py_XDECREF(new);
-    if (ca) DestroyImageList(ca);
     if (cnew) DestroyImageList(cnew);
     return NULL;
 }
@@ -5235,19 +6930,32 @@ mimage_repeat(PyMImageObject *a, int n)
 static PyObject *
 mimage_inplace_repeat(PyMImageObject *a, int n)
 {
-    Image *ca=NULL;
-    int i;
+    Image *tail;
+    ExceptionInfo exception;
 
-    for (i=0; i<n; i++) {
-        ca = CloneImageList(a->ims, &exception);
+    GetExceptionInfo(&exception);
+    if (n <= 0) {
+        if (a->ims) DestroyImageList(a->ims);
+        a->ims = NULL;
+    }
+    else if (a->ims != NULL) {
+        tail = GetLastImageInList(a->ims);
+        if (!repeat_frames(a->ims, tail, n, &exception)) {
+            /* keep the image as it was */
+            if (tail->next) {
+                tail->next->previous = NULL;
+                DestroyImageList(tail->next);
+            }
+            tail->next = NULL;
+        }
+        mimage_changed(a);
         CHECK_ERR;
-        AppendImageToList(&(a->ims),ca);
     }
+    mimage_changed(a);
     Py_INCREF(a);
     return (PyObject *)a;
 
  fail: 
-    if (ca) DestroyImageList(ca);
     return NULL;
 }
 
@@ -5255,32 +6963,27 @@ mimage_inplace_repeat(PyMImageObject *a, int n)
 static PyObject *
 mimage_slice(PyMImageObject *a, int ilow, int ihigh)
 {
-    int k, N;
-    Image *img, *cpy=NULL;
+    long N;
     Image *new=NULL;
     PyMImageObject *obj=NULL;
+    ExceptionInfo exception;
 
-    N = GetImageListLength(a->ims);
+    GetExceptionInfo(&exception);
+    if ((N = mimage_frames(a)) < 0) return NULL;
     if (ilow < 0) ilow = 0;
     else if (ilow > N) ilow = N;
     if (ihigh < ilow) ihigh = ilow;
     else if (ihigh > N) ihigh = N;
     
-    obj = PyObject_New(PyMImageObject, &MImage_Type);    
+    obj = mimage_alloc();    
     if (obj == NULL) goto fail;
+    obj->ims = NULL;
 
-    img = a->ims;
-    for (k=0; img != NULL; img=img->next)
-        if (k++ >= ilow)
-            break;
-    k--;
-    while( (k < ihigh) && (img != NULL)) {     
-        cpy = CloneImage(img,0,0,1,&exception); /* Get current Image */
-        CHECK_ERR;
-        AppendImageToList(&new, cpy);
-        img=img->next;
-        k++;
-    }    
+    if (ihigh > ilow) {
+        new = share_frames(mimage_frame(a, ilow), ihigh - ilow, &exception);
+        if (PyErr_Occurred()) goto fail;
+    }
+    CHECK_ERR;
     obj->ims = new;
     return (PyObject *)obj;
 
@@ -5293,9 +6996,9 @@ mimage_slice(PyMImageObject *a, int ilow, int ihigh)
 static PyObject *
 mimage_item(PyMImageObject *a, int i)
 {
-    int N;
+    long N;
 
-    N = GetImageListLength(a->ims);
+    if ((N = mimage_frames(a)) < 0) return NULL;
     if ((i < 0) || (i >= N)) {
         PyErr_SetString(PyExc_IndexError, "Invalid index.");
         return NULL;
@@ -5307,89 +7010,71 @@ mimage_item(PyMImageObject *a, int i)
 static int
 mimage_ass_slice(PyMImageObject *a, int ilow, int ihigh, PyObject *v) 
 {
-    Image *img, *cpy=NULL;
-    Image *a1, *a2, *b1=NULL, *b2, *c1=NULL, *start=NULL;
+    Image *img, *before, *after, *old, *first=NULL, *last=NULL;
     ImageInfo *info=NULL;
     PyObject *tmp=NULL;
-    
-    int N, k, P, split = 0;
+    long k, N, P=0;
     
     if ((v!=NULL) && (!PySequence_Check(v))) ERRMSG("Must use sequence object when assigning to slice");
     
-    P = PySequence_Length(v);
-    N = GetImageListLength(a->ims);
+    /* Convert the new frames first so that a failure leaves the
+       sequence untouched.  Converting runs arbitrary code, which may
+       change a, so the frame table is only read afterwards. */
+    if (v != NULL) {
+        if ((P = PySequence_Length(v)) < 0) goto fail;
+        info = CloneImageInfo(NULL);
+        for (k=0; k<P; k++) {
+            tmp = PySequence_GetItem(v,k);
+            if (tmp == NULL) goto fail;
+            img = _convert_object(tmp, info);
+            if (img == NULL) ERRMSG("Error in converting to an Image Object");
+            Py_DECREF(tmp);
+            tmp = NULL;
+            img = GetFirstImageInList(img);
+            if (first == NULL) first = img;
+            else {
+                last->next = img;
+                img->previous = last;
+            }
+            last = GetLastImageInList(img);
+        }
+        DestroyImageInfo(info);
+        info = NULL;
+    }
+
+    if ((N = mimage_frames(a)) < 0) goto fail;
     if (ilow < 0) ilow = 0;
     else if (ilow > N) ilow = N;
     if (ihigh < ilow) ihigh = ilow;
     else if (ihigh > N) ihigh = N;
+    if ((ilow == ihigh) && (first == NULL)) return 0;
 
-    if (ilow == ihigh) {
-        /* Do nothing */
-        return 0;
-    }
-    
-    if (v == NULL) {
-        img = a->ims;
-        for (k=0; img != NULL; img=img->next)
-            if (k++ >= ilow)
-                break;
-        k--;
-        if (img) start = img->previous;   /* Last entry to keey */
-        /* img points to start of slice to delete */
-        while( (k < ihigh) && (img != NULL)) {
-            cpy = GetNextImageInList(img);
-            DestroyImage(img);
-            img = cpy;
-            k++;
-        }    
-        if (start) start->next = img;    /* Reconnect */
-        if (img) img->previous = start;        
-        return 0;
+    /* Unlink frames ilow..ihigh-1 and put the new frames in their place */
+    before = (ilow > 0) ? a->frames[ilow-1] : NULL;
+    after = (ihigh < N) ? a->frames[ihigh] : NULL;
+    old = (ihigh > ilow) ? a->frames[ilow] : NULL;
+    if (old != NULL) {
+        old->previous = NULL;
+        a->frames[ihigh-1]->next = NULL;
     }
-
-    /* In short, first we split the image list into three lists:
-       1) from the beginning to ilow-1   (a1, a2)
-       2) from ilow to ihigh-1           (b1, b2)
-       3) from ihigh to the end          (c1, c2)
-
-       The new image sequence is 1) + converted sequence + 3) 
-    */
-
-    a1 = a->ims;
-    img = a1;
-    for (k=0; img!=NULL; img=img->next)
-        if (k++ >= ilow-1)
-            break;
-    /* now img points to a2 */
-    a2 = img;
-    for (k=ilow; img!= NULL; img=img->next)
-        if (k++ >= ihigh-1)
-            break;
-    b2 = img;
-    b1 = SplitImageList(a2);
-    c1 = SplitImageList(b2);
-    split = 1;
-    info = CloneImageInfo(NULL);
-    /* Now append to the end of the List */
-    for (k=0; k<P; k++) {
-        tmp = PySequence_GetItem(v,k);
-        img = _convert_object(tmp, info);
-        if (img == NULL) ERRMSG("Error in converting to an Image Object");        
-        AppendImageToList(&a1, img);
-        Py_DECREF(tmp);
+    if (first == NULL) {
+        first = after;
+        last = before;
     }
-
-    DestroyImageInfo(info);
-    AppendImageToList(&a1, c1); /* Reattach final piece */
-    DestroyImageList(b1);  /* Get rid of spliced out element */
+    else {
+        first->previous = before;
+        last->next = after;
+    }
+    if (before) before->next = first;
+    else a->ims = first;
+    if (after) after->previous = last;
+    mimage_changed(a);
+    if (old != NULL) DestroyImageList(old);
     return 0;
     
  fail:
     Py_XDECREF(tmp);
-    if (split) {  /* Reattach spliced-out image sequence */
-        AppendImageToList(&a1,b1);
-        AppendImageToList(&a1,c1);
-    }
+    if (first) DestroyImageList(first);
     if (info) DestroyImageInfo(info);
     return -1;
 
@@ -5496,6 +7181,107 @@ static PyTypeObject MImage_Type = {
 
 
 
+/**********************************************************************
+ *
+ *   B l o b O b j e c t
+ *
+ */
+
+/* Encoded image data from img.tobytes().  The object owns the memory
+   GraphicsMagick allocated for the blob and hands it out through the
+   buffer interface, so it can be written to a file or socket (or turned
+   into a string with str(buffer(blob))) without another copy. */
+static void
+blob_dealloc(PyObject *self)
+{
+    MagickFree(ASBLOB(self)->data);
+    PyObject_Del(self);
+}
+
+static Py_ssize_t
+blob_length(PyObject *self)
+{
+    return (Py_ssize_t) ASBLOB(self)->length;
+}
+
+static Py_ssize_t
+blob_getreadbuf(PyObject *self, Py_ssize_t segment, void **ptr)
+{
+    if (segment != 0) {
+        PyErr_SetString(PyExc_SystemError, 
+                        "Accessing non-existent blob segment");
+        return -1;
+    }
+    *ptr = ASBLOB(self)->data;
+    return (Py_ssize_t) ASBLOB(self)->length;
+}
+
+static Py_ssize_t
+blob_getsegcount(PyObject *self, Py_ssize_t *lenp)
+{
+    if (lenp) *lenp = (Py_ssize_t) ASBLOB(self)->length;
+    return 1;
+}
+
+static Py_ssize_t
+blob_getcharbuf(PyObject *self, Py_ssize_t segment, char **ptr)
+{
+    return blob_getreadbuf(self, segment, (void **) ptr);
+}
+
+#if PY_VERSION_HEX >= 0x02060000
+static int
+blob_getbuffer(PyObject *self, Py_buffer *view, int flags)
+{
+    return PyBuffer_FillInfo(view, self, ASBLOB(self)->data, 
+                             (Py_ssize_t) ASBLOB(self)->length, 1, flags);
+}
+#define BLOB_TPFLAGS (Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER)
+#else
+#define BLOB_TPFLAGS Py_TPFLAGS_DEFAULT
+#endif
+
+static PySequenceMethods blob_as_sequence = {
+    (lenfunc)blob_length,       /* sq_length */
+};
+
+static PyBufferProcs blob_as_buffer = {
+    (readbufferproc)blob_getreadbuf,    /* bf_getreadbuffer */
+    0,                                  /* bf_getwritebuffer */
+    (segcountproc)blob_getsegcount,     /* bf_getsegcount */
+    (charbufferproc)blob_getcharbuf,    /* bf_getcharbuffer */
+#if PY_VERSION_HEX >= 0x02060000
+    (getbufferproc)blob_getbuffer,      /* bf_getbuffer */
+    0,                                  /* bf_releasebuffer */
+#endif
+};
+
+static PyTypeObject Blob_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                                
+    "MagickBlob",                      /* tp_name */
+    sizeof(PyBlobObject),              /* tp_basicsize */
+    0,                                 /* tp_itemsize */
+    (destructor)blob_dealloc,          /* tp_dealloc */
+    0,          /* tp_print*/
+    0,          /* tp_getattr*/
+    0,          /* tp_setattr*/
+    0,          /* tp_compare*/
+    0,          /* tp_repr*/
+    0,          /* tp_as_number*/
+    &blob_as_sequence,          /* tp_as_sequence*/
+    0,          /* tp_as_mapping*/
+    0,          /* tp_hash */
+    0,          /* tp_call */
+    0,          /* tp_str */
+    0,          /* tp_getattro */
+    0,          /* tp_setattro */
+    &blob_as_buffer,          /* tp_as_buffer */
+    BLOB_TPFLAGS,          /* tp_flags */
+    "Encoded image data (supports the buffer interface)",  /* tp_doc */
+};
+
+
 /**********************************************************************
  *
  *   D r a w I n f o O b j e c t
@@ -5505,42 +7291,57 @@ static PyTypeObject MImage_Type = {
 #ifndef MAX
 #define MAX(a,b) (((a) > (b)) ? (a) : (b))
 #endif
+/* Make room for n more bytes of primitives plus the newline and null
+   that end each one.  The buffer at least doubles when it grows, so
+   building up a long drawing stays linear.  Returns the place to write
+   to, or NULL with the error set. */
+static char *
+draw_prim_reserve(PyObject *draw, size_t n)
+{
+    PyDrawInfoObject *di = ASDI(draw);
+    size_t need = (size_t) di->len + n + 2, alloc;
+    char *prim;
+
+    if (need > (size_t) di->alloc) {
+        alloc = MAX(2*(size_t) di->alloc, (size_t) DRAWALLOCSIZE);
+        alloc = MAX(alloc, need);
+        prim = MagickRealloc(di->prim, alloc);
+        if (prim == NULL) {
+            PyErr_SetString(PyMagickError, "Memory allocation error."\
+                            " Drawing commands may be lost.");
+            return NULL;
+        }
+        di->prim = prim;
+        di->alloc = (long) alloc;
+    }
+    return di->prim + di->len;
+}
+
+/* End the n bytes just written at draw_prim_reserve()'s pointer */
+static void
+draw_prim_commit(PyObject *draw, size_t n)
+{
+    PyDrawInfoObject *di = ASDI(draw);
+
+    di->prim[di->len + n] = '\n';
+    di->prim[di->len + n + 1] = '\0';  /* add null termination */
+    di->len += (long) n + 1;
+}
+
 static int
 draw_prim_cat(PyObject *draw, char *src, int M)
 {
-    size_t toexpand;
-    long len;
     size_t N;
-    PyDrawInfoObject *di;
+    char *q;
 
-    di = ASDI(draw);
-    
     if (M <= 0)
         N = strlen(src);
     else
         N = M;
     
-    len = di->len;
-    if ((len + N+1) > di->alloc)
-    {
-        toexpand = MAX(N+1, DRAWALLOCSIZE);
-        di->alloc += toexpand;
-        
-        di->prim = MagickRealloc(di->prim, (size_t) di->alloc);
-        
-        if (!di->prim) {
-            di->len = 0;
-            di->alloc = 0;
-            PyErr_SetString(PyMagickError, "Memory allocation error."\
-                            " Drawing commands may be lost.");
-            return False;
-        }
-    }
-    
-    
-    (void )strncpy(di->prim+len, src, N); 
-    (void )strncpy(di->prim+len+N, "\n", 2); /* add null termination */
-    di->len += N+1;
+    if ((q = draw_prim_reserve(draw, N)) == NULL) return False;
+    memcpy(q, src, N);
+    draw_prim_commit(draw, N);
     return True;
 }
 
@@ -5584,6 +7385,7 @@ clear_draw(PyObject *self)
     di = ASDI(self);
     if (di->prim)
         MagickFree(di->prim);
+    di->prim = NULL;
     di->alloc = 0;
     di->len = 0;
     Py_INCREF(Py_None);
@@ -5613,54 +7415,52 @@ arc_draw(PyObject *self, PyObject *args)
 }
 
 #define MaxTextFloat 30
-static char doc_bezier_draw[] = \
-"dc.bezier(points)\n\n"\
-" Add a bezier curve to the drawing";
+
+/* Add the primitive name x0,y0,x1,y1,... with the coordinates taken from
+   a sequence or array (double arrays are used in place), formatted
+   straight into the primitive buffer. */
 static PyObject *
-bezier_draw(PyObject *self, PyObject *args)
+draw_points(PyObject *self, PyObject *args, char *name)
 {
     PyObject *points;
     PyObject *arr=NULL;
-    PyObject *iobj=NULL;
-    PyObject *allobj=NULL;
-    char single[MaxTextFloat];
-    char *msg=NULL;
     double *arrptr;
-    int N, k, len;
+    char *q;
+    size_t len;
+    long N, k;
     
     if (!PyArg_ParseTuple(args, "O", &points)) return NULL;
     
     arr = PyArray_ContiguousFromObject(points,PyArray_DOUBLE,1,2);
     if (arr==NULL) return NULL;    
     N = PyArray_SIZE(ASARR(arr));
-    if (N%2 == 1)
+    if ((N == 0) || (N%2 == 1))
         ERRMSG("Need an even number of points.");
 
     arrptr = (double *)DATA(arr);
-    snprintf(single, MaxTextFloat, "Bezier %g", *arrptr++);
-    allobj = PyString_FromString(single);
-    if (allobj==NULL) goto fail;
-    for (k=1; k < N; k++) {
-        snprintf(single, MaxTextFloat, ",%g", *arrptr++);
-        iobj = PyString_FromString(single);
-        if (iobj == NULL) goto fail;
-        PyString_ConcatAndDel(&allobj, iobj);
-        if (allobj==NULL) goto fail;
-    }
-    msg = PyString_AS_STRING(allobj);
-    len = PyString_GET_SIZE(allobj);
-    if (!draw_prim_cat(self, msg, len)) goto fail;
+    q = draw_prim_reserve(self, strlen(name) + N*MaxTextFloat);
+    if (q == NULL) goto fail;
+    len = sprintf(q, "%s %g", name, *arrptr++);
+    for (k=1; k < N; k++)
+        len += sprintf(q + len, ",%g", *arrptr++);
+    draw_prim_commit(self, len);
     
-    Py_DECREF(allobj);
     Py_DECREF(arr);
     Py_INCREF(Py_None);
     return Py_None;    
     
  fail:
-    Py_XDECREF(allobj);
     Py_XDECREF(arr);
     return NULL;
 }
+static char doc_bezier_draw[] = \
+"dc.bezier(points)\n\n"\
+" Add a bezier curve to the drawing";
+static PyObject *
+bezier_draw(PyObject *self, PyObject *args)
+{
+    return draw_points(self, args, "Bezier");
+}
 
 
 static char doc_circle_draw[] = \
@@ -5774,47 +7574,7 @@ static char doc_polygon_draw[] = \
 static PyObject *
 polygon_draw(PyObject *self, PyObject *args)
 {
-    PyObject *points;
-    PyObject *arr=NULL;
-    PyObject *iobj=NULL;
-    PyObject *allobj=NULL;
-    char single[MaxTextFloat];
-    char *msg=NULL;
-    double *arrptr;
-    int N, k, len;
-    
-    if (!PyArg_ParseTuple(args, "O", &points)) return NULL;
-    
-    arr = PyArray_ContiguousFromObject(points,PyArray_DOUBLE,1,2);
-    if (arr==NULL) return NULL;    
-    N = PyArray_SIZE(ASARR(arr));
-    if (N%2 == 1)
-        ERRMSG("Need an even number of points.");
-
-    arrptr = (double *)DATA(arr);
-    snprintf(single, MaxTextFloat, "polygon %g", *arrptr++);
-    allobj = PyString_FromString(single);
-    if (allobj==NULL) goto fail;
-    for (k=1; k < N; k++) {
-        snprintf(single, MaxTextFloat, ",%g", *arrptr++);
-        iobj = PyString_FromString(single);
-        if (iobj == NULL) goto fail;
-        PyString_ConcatAndDel(&allobj, iobj);
-        if (allobj==NULL) goto fail;
-    }
-    msg = PyString_AS_STRING(allobj);
-    len = PyString_GET_SIZE(allobj);
-    if (!draw_prim_cat(self, msg, len)) goto fail;
-    
-    Py_DECREF(allobj);
-    Py_DECREF(arr);
-    Py_INCREF(Py_None);
-    return Py_None;    
-    
- fail:
-    Py_XDECREF(allobj);
-    Py_XDECREF(arr);
-    return NULL;
+    return draw_points(self, args, "polygon");
 }
 
 static char doc_polyline_draw[] = \
@@ -5823,47 +7583,7 @@ static char doc_polyline_draw[] = \
 static PyObject *
 polyline_draw(PyObject *self, PyObject *args)
 {
-    PyObject *points;
-    PyObject *arr=NULL;
-    PyObject *iobj=NULL;
-    PyObject *allobj=NULL;
-    char single[MaxTextFloat];
-    char *msg=NULL;
-    double *arrptr;
-    int N, k, len;
-    
-    if (!PyArg_ParseTuple(args, "O", &points)) return NULL;
-    
-    arr = PyArray_ContiguousFromObject(points,PyArray_DOUBLE,1,2);
-    if (arr==NULL) return NULL;    
-    N = PyArray_SIZE(ASARR(arr));
-    if (N%2 == 1)
-        ERRMSG("Need an even number of points.");
-
-    arrptr = (double *)DATA(arr);
-    snprintf(single, MaxTextFloat, "polyline %g", *arrptr++);
-    allobj = PyString_FromString(single);
-    if (allobj==NULL) goto fail;
-    for (k=1; k < N; k++) {
-        snprintf(single, MaxTextFloat, ",%g", *arrptr++);
-        iobj = PyString_FromString(single);
-        if (iobj == NULL) goto fail;
-        PyString_ConcatAndDel(&allobj, iobj);
-        if (allobj==NULL) goto fail;
-    }
-    msg = PyString_AS_STRING(allobj);
-    len = PyString_GET_SIZE(allobj);
-    if (!draw_prim_cat(self, msg, len)) goto fail;
-    
-    Py_DECREF(allobj);
-    Py_DECREF(arr);
-    Py_INCREF(Py_None);
-    return Py_None;    
-    
- fail:
-    Py_XDECREF(allobj);
-    Py_XDECREF(arr);
-    return NULL;
+    return draw_points(self, args, "polyline");
 }
 
 
@@ -5966,10 +7686,62 @@ text_draw(PyObject *self, PyObject *args)
     return Py_None;
 }
 
+/* True if prim uses a primitive or keyword whose result depends on the
+   pixels already in the target image */
+static int
+drawing_reads_target(const char *prim)
+{
+    static char *words[] = {"color", "matte", "image", "compose", NULL};
+    const char *p = prim, *start;
+    size_t n;
+    int k;
+
+    while (*p) {
+        while (*p && isspace((unsigned char) *p)) p++;
+        for (start=p; *p && !isspace((unsigned char) *p); p++);
+        n = (size_t) (p - start);
+        for (k=0; words[k]; k++)
+            if ((strlen(words[k]) == n) && !strncmp(start, words[k], n))
+                return 1;
+    }
+    return 0;
+}
+
+static char doc_compile_draw[] = "drawing = dc.compile()\n\n"\
+" Return a drawing holding the settings and primitives of dc, to be\n"\
+"   drawn with img.draw(drawing) on any number of images.  dc is not\n"\
+"   cleared.  The primitives are parsed and rendered once per frame size\n"\
+"   onto a transparent overlay which is then composited over each frame.\n"\
+"   Drawings whose primitives read the target (color, matte, image or\n"\
+"   compose) or whose context composes other than Over are drawn\n"\
+"   directly onto every frame instead, as are frames that are not RGB.";
+static PyObject *
+compile_draw(PyObject *self)
+{
+    PyDrawingObject *new;
+    char *prim = ASDI(self)->prim;
+
+    new = PyObject_New(PyDrawingObject, &Drawing_Type);
+    if (new == NULL) return NULL;
+    memset(new->overlays, 0, sizeof(new->overlays));
+    new->info = CloneDrawInfo(NULL, ASDI(self)->info);
+    if ((new->info == NULL) || 
+        ((prim != NULL) && !CloneString(&(new->info->primitive), prim))) {
+        Py_DECREF(new);
+        PyErr_SetString(PyMagickError, "Could not copy the drawing context.");
+        return NULL;
+    }
+    /* Only Over composites an overlay the way DrawImage() blends */
+    new->direct = (new->info->compose != OverCompositeOp) ||
+        ((prim != NULL) && drawing_reads_target(prim));
+    return (PyObject *)new;
+}
+
 static PyMethodDef drawinfo_methods[] = {
   {"addany", (PyCFunction)addany_draw, METH_O, doc_addany_draw},
   {"getall", (PyCFunction)getall_draw, METH_NOARGS, doc_getall_draw},
   {"clear", (PyCFunction)clear_draw, METH_NOARGS, doc_clear_draw},
+  {"compile", (PyCFunction)compile_draw, METH_NOARGS, doc_compile_draw},
   {"arc", (PyCFunction)arc_draw, METH_VARARGS, doc_arc_draw},
   {"bezier", (PyCFunction)bezier_draw, METH_VARARGS, doc_bezier_draw},
   {"circle", (PyCFunction)circle_draw, METH_VARARGS, doc_circle_draw},
@@ -6007,7 +7779,9 @@ static PyObject *
 drawattr_get(DrawInfo *dinfo, char *attr)
 {
     PyObject *obj=NULL;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
     switch(*attr) {
     case 'a':
     if (strcmp(attr, "affine")==0) {
@@ -6118,7 +7892,7 @@ drawattr_get(DrawInfo *dinfo, char *attr)
             return PyInt_FromLong(dinfo->weight);
     }
     else if (strcmp(attr, "fill_pattern")==0) {
-            obj = (PyObject *)PyObject_New(PyMImageObject, &MImage_Type);
+            obj = (PyObject *)mimage_alloc();
             if (obj == NULL) return NULL;
             ASIM(obj)->ims = dinfo->fill_pattern ? CloneImage(dinfo->fill_pattern,0,0,True,&exception) : NULL;
             CHECK_ERR;
@@ -6164,7 +7938,7 @@ drawattr_get(DrawInfo *dinfo, char *attr)
             return PyInt_FromLong(dinfo->stroke_antialias != 0);
     }
     else if (strcmp(attr, "stroke_pattern")==0) {
-            obj = (PyObject *)PyObject_New(PyMImageObject, &MImage_Type);
+            obj = (PyObject *)mimage_alloc();
             if (obj == NULL) return NULL;
             ASIM(obj)->ims = dinfo->stroke_pattern ? CloneImage(dinfo->stroke_pattern,0,0,True,&exception) : NULL;
             CHECK_ERR;
@@ -6182,7 +7956,7 @@ drawattr_get(DrawInfo *dinfo, char *attr)
             return PyInt_FromLong(dinfo->text_antialias != 0);
     }
     else if (strcmp(attr, "tile")==0) {
-            obj = (PyObject *)PyObject_New(PyMImageObject, &MImage_Type);
+            obj = (PyObject *)mimage_alloc();
             if (obj == NULL) return NULL;
             ASIM(obj)->ims = dinfo->tile ? CloneImage(dinfo->tile,0,0,True,&exception) : NULL;
             CHECK_ERR;
@@ -6244,7 +8018,9 @@ drawinfo_setattr(PyDrawInfoObject *self, char *attr, PyObject *val)
     char *tmpstr;
     PyObject *arr;
     int N;
+    ExceptionInfo exception;
 
+    GetExceptionInfo(&exception);
     if (val == NULL) 
     ERRMSG("Cannot delete DrawInfo attributes.");
     
@@ -6609,6 +8385,129 @@ static PyTypeObject DrawInfo_Type = {
     0,          /* tp_defined */
 };
 
+
+/**********************************************************************
+ *
+ *   D r a w i n g O b j e c t
+ *
+ */
+
+/* A drawing from dc.compile().  DrawImage() parses the primitive text
+   every time it is called, so a drawing is rendered once for each frame
+   size onto a transparent overlay (kept for the last DRAWING_SIZES
+   sizes) and composited Over each frame after that.  Drawing onto
+   transparency and compositing Over gives the same result as drawing
+   onto the frame, except for primitives that look at the target or a
+   compose other than Over, which make the drawing direct, and for frames
+   in another colorspace (CMYK, ...), which are always drawn directly. */
+static void
+drawing_dealloc(PyObject *self)
+{
+    PyDrawingObject *d = ASDRAWING(self);
+    int k;
+
+    if (d->info) DestroyDrawInfo(d->info);
+    for (k=0; k < DRAWING_SIZES; k++)
+        if (d->overlays[k]) DestroyImage(d->overlays[k]);
+    PyObject_Del(self);
+}
+
+/* The overlay for frames of image's size, rendered if not yet kept */
+static Image *
+drawing_overlay(PyDrawingObject *d, const Image *image, 
+                ExceptionInfo *exception)
+{
+    Image *overlay;
+    int k;
+
+    for (k=0; k < DRAWING_SIZES; k++) {
+        overlay = d->overlays[k];
+        if (overlay && (overlay->columns == image->columns) &&
+            (overlay->rows == image->rows)) return overlay;
+    }
+    overlay = AllocateImage((ImageInfo *) NULL);
+    if (overlay == NULL) {
+        ThrowException(exception, ResourceLimitError, 
+                       "MemoryAllocationFailed", "UnableToDrawOnImage");
+        return NULL;
+    }
+    overlay->columns = image->columns;
+    overlay->rows = image->rows;
+    overlay->matte = True;
+    overlay->background_color.opacity = TransparentOpacity;
+    SetImage(overlay, TransparentOpacity);
+    if (!DrawImage(overlay, d->info) || 
+        (overlay->exception.severity >= ErrorException)) {
+        ThrowException(exception, overlay->exception.severity,
+                       overlay->exception.reason,
+                       overlay->exception.description);
+        DestroyImage(overlay);
+        return NULL;
+    }
+    if (d->overlays[DRAWING_SIZES-1]) 
+        DestroyImage(d->overlays[DRAWING_SIZES-1]);
+    for (k=DRAWING_SIZES-1; k > 0; k--) d->overlays[k] = d->overlays[k-1];
+    d->overlays[0] = overlay;
+    return overlay;
+}
+
+/* img.draw(drawing) on every frame of images */
+static int
+draw_compiled(PyObject *obj, Image *images)
+{
+    PyDrawingObject *d = ASDRAWING(obj);
+    Image *mag, *overlay;
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
+    if (d->info->primitive == NULL) return 1;
+    for (mag=images; mag; mag=mag->next) {
+        if (d->direct || (mag->colorspace != RGBColorspace)) {
+            DrawImage(mag, d->info);
+            CHECK_ERR_IM(mag);
+            continue;
+        }
+        overlay = drawing_overlay(d, mag, &exception);
+        if (overlay == NULL) {
+            CHECK_ERR;
+            ERRMSG("Could not render the drawing.");
+        }
+        if (!CompositeImage(mag, OverCompositeOp, overlay, 0, 0))
+            CHECK_ERR_IM(mag);
+    }
+    DestroyExceptionInfo(&exception);
+    return 1;
+
+ fail:
+    DestroyExceptionInfo(&exception);
+    return 0;
+}
+
+static PyTypeObject Drawing_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                                
+    "MagickDrawing",                   /* tp_name */
+    sizeof(PyDrawingObject),           /* tp_basicsize */
+    0,                                 /* tp_itemsize */
+    (destructor)drawing_dealloc,       /* tp_dealloc */
+    0,          /* tp_print*/
+    0,          /* tp_getattr*/
+    0,          /* tp_setattr*/
+    0,          /* tp_compare*/
+    0,          /* tp_repr*/
+    0,          /* tp_as_number*/
+    0,          /* tp_as_sequence*/
+    0,          /* tp_as_mapping*/
+    0,          /* tp_hash */
+    0,          /* tp_call */
+    0,          /* tp_str */
+    0,          /* tp_getattro */
+    0,          /* tp_setattro */
+    0,          /* tp_as_buffer */
+    0,          /* tp_flags */
+    "Drawing primitives compiled by dc.compile()",  /* tp_doc */
+};
+
 static PyObject *
 magick_new_draw(PyObject *self, PyObject *args, PyObject *kwds)
 {
@@ -6649,52 +8548,1393 @@ magick_new_draw(PyObject *self, PyObject *args, PyObject *kwds)
 
 
 
+/*
+  Streaming pipeline.
+
+  stream() never holds a whole image.  ReadStream() hands over the decoded
+  rows as the coder produces them; they are collected into a strip, run
+  through the row-local operations and written out before the next strip
+  is read, so peak memory is one strip of pixels however large the image.
+
+  GraphicsMagick's encoders read their input from a complete pixel cache,
+  so the output side is written here as raw samples: netpbm (PGM, PPM,
+  PAM) or headerless GRAY, RGB and RGBA, which any encoder can take
+  in turn.
+*/
+#define STREAM_LEVEL 0
+#define STREAM_GAMMA 1
+#define STREAM_NEGATE 2
+#define STREAM_COLORIZE 3
+#define STREAM_DEPTH 4
+#define STREAM_THRESHOLD 5
+#define STREAM_MODULATE 6
+#define STREAM_PER_CHANNEL(kind) ((kind) <= STREAM_DEPTH)
+
+#define STREAM_MAP 0        /* kinds of StreamStage */
+#define STREAM_BILEVEL 1
+#define STREAM_HSL 2
+
+#define STREAM_QUANTUM(v) ((v) <= 0.0 ? (Quantum) 0 : \
+                           ((v) >= MaxRGB ? (Quantum) MaxRGB : \
+                            (Quantum) ((v) + 0.5)))
+#define STREAM_INTENSITY(p) ((Quantum) (0.299*(p)->red + 0.587*(p)->green \
+                                        + 0.114*(p)->blue + 0.5))
+
+static char *StreamFormats[] = {"GRAY", "RGB", "RGBA", "PGM", "PPM", "PAM",
+                                NULL};
+#define STREAM_GRAY 0
+#define STREAM_RGB 1
+#define STREAM_RGBA 2
+#define STREAM_PGM 3
+#define STREAM_PPM 4
+#define STREAM_PAM 5
+
+typedef struct {
+    int kind;
+    double v[3];        /* level: black, mid, white; gamma: per channel;
+                           colorize: the color; depth: largest level;
+                           threshold: the level; modulate: brightness,
+                           saturation and hue as fractions */
+    double blend[3];    /* colorize: fraction of the color per channel */
+} StreamOp;
+
+/* A run of per-channel operations folded into one table per channel,
+   or a threshold or modulate, which mix the channels and so end a run. */
+typedef struct {
+    int kind;
+    long first, last;   /* the run of ops, used when there is no map */
+    Quantum *map;       /* red, green and blue tables of MaxRGB+1 */
+    double level;
+} StreamStage;
+
+/* The stages applied, in order, to every pixel */
+typedef struct {
+    const StreamOp *ops;
+    const StreamStage *stages;
+    int nstages;
+} PointProgram;
+
+typedef struct {
+    PointProgram prog;
+    FILE *file;
+    int format, bytes, channels;
+    unsigned long columns, rows, y;   /* frame size and rows read */
+    long height, n;                   /* strip height and rows held */
+    PixelPacket *strip;
+    unsigned char *out;
+    size_t rowbytes;
+    const char *error;
+} StreamJob;
+
+/* ReadStream() passes no user data to its handler, so streams take
+   turns on one job pointer. */
+static PyThread_type_lock _streamlock = NULL;
+static StreamJob *_streamjob = NULL;
+
+static double
+stream_point(const StreamOp *op, int channel, double v)
+{
+    double gamma;
+
+    switch (op->kind) {
+    case STREAM_LEVEL:
+        if (v <= op->v[0]) return 0.0;
+        if (v >= op->v[2]) return MaxRGB;
+        return MaxRGB*pow((v - op->v[0]) / (op->v[2] - op->v[0]), 
+                          1.0/op->v[1]);
+    case STREAM_GAMMA:
+        gamma = op->v[channel];
+        if (gamma == 0.0) return (v >= MaxRGB) ? MaxRGB : 0.0;
+        return MaxRGB*pow(v/MaxRGB, 1.0/gamma);
+    case STREAM_NEGATE:
+        return MaxRGB - v;
+    case STREAM_COLORIZE:
+        return v*(1.0 - op->blend[channel]) + 
+            op->v[channel]*op->blend[channel];
+    case STREAM_DEPTH:
+        return floor(v/MaxRGB*op->v[0] + 0.5)*MaxRGB/op->v[0];
+    }
+    return v;
+}
+
+static Quantum
+stream_run(const StreamOp *ops, long first, long last, int channel, 
+           Quantum q)
+{
+    double v = q;
+    long k;
+
+    for (k=first; k < last; k++) {
+        v = stream_point(&ops[k], channel, v);
+        v = STREAM_QUANTUM(v);
+    }
+    return (Quantum) v;
+}
+
+/* Parse one ('name', args...) tuple of stream() into op */
+static int
+stream_parse_op(StreamOp *op, PyObject *item)
+{
+    PyObject *rest=NULL, *color=NULL;
+    PixelPacket target;
+    double a=0.0, b=1.0, c=(double)MaxRGB;
+    char *name;
+    int n, bits;
+
+    if (!PyTuple_Check(item) || (PyTuple_GET_SIZE(item) < 1) ||
+        !PyString_Check(PyTuple_GET_ITEM(item, 0)))
+        ERRMSG("Each operation must be a tuple starting with its name.");
+    name = PyString_AS_STRING(PyTuple_GET_ITEM(item, 0));
+    rest = PyTuple_GetSlice(item, 1, PyTuple_GET_SIZE(item));
+    if (rest == NULL) goto fail;
+    n = PyTuple_GET_SIZE(rest);
+    if (strEQ(name, "level")) {
+        if (!PyArg_ParseTuple(rest, "|ddd:level", &a, &b, &c)) goto fail;
+        if (a < 1) a *= MaxRGB;
+        if (c < 1) c *= MaxRGB;
+        if ((a < 0) || (c > MaxRGB) || (a >= c) || (b <= 0) || (b > 10))
+            ERRMSG("level needs 0 <= black < white <= MaxRGB and "\
+                   "0 < mid <= 10.");
+        op->kind = STREAM_LEVEL;
+        op->v[0] = a; op->v[1] = b; op->v[2] = c;
+    }
+    else if (strEQ(name, "gamma")) {
+        if (!PyArg_ParseTuple(rest, "d|dd:gamma", &a, &b, &c)) goto fail;
+        if (n < 3) c = a;
+        if (n < 2) b = a;
+        if ((a < 0) || (b < 0) || (c < 0))
+            ERRMSG("gamma values must not be negative.");
+        op->kind = STREAM_GAMMA;
+        op->v[0] = a; op->v[1] = b; op->v[2] = c;
+    }
+    else if (strEQ(name, "negate")) {
+        if (!PyArg_ParseTuple(rest, ":negate")) goto fail;
+        op->kind = STREAM_NEGATE;
+    }
+    else if (strEQ(name, "threshold")) {
+        if (!PyArg_ParseTuple(rest, "d:threshold", &a)) goto fail;
+        if (a < 1) a *= MaxRGB;
+        if ((a < 0) || (a > MaxRGB))
+            ERRMSG("threshold must be in range 0 to MaxRGB.");
+        op->kind = STREAM_THRESHOLD;
+        op->v[0] = a;
+    }
+    else if (strEQ(name, "colorize")) {
+        a = 0.25;
+        if (!PyArg_ParseTuple(rest, "O|ddd:colorize", &color, &a, &b, &c))
+            goto fail;
+        if (n < 4) c = a;
+        if (n < 3) b = a;
+        if ((a < 0.0) || (a > 1.0) || (b < 0.0) || (b > 1.0) || 
+            (c < 0.0) || (c > 1.0))
+            ERRMSG("Red, green, and blue blend values must be"\
+                   " between 0.0 and 1.0");
+        if (!set_color_from_obj(&target, color, "color")) goto fail;
+        op->kind = STREAM_COLORIZE;
+        op->v[0] = target.red; op->v[1] = target.green; 
+        op->v[2] = target.blue;
+        op->blend[0] = a; op->blend[1] = b; op->blend[2] = c;
+    }
+    else if (strEQ(name, "modulate")) {
+        b = c = 100.0;
+        if (!PyArg_ParseTuple(rest, "d|dd:modulate", &a, &b, &c)) goto fail;
+        if ((a < 0) || (b < 0))
+            ERRMSG("brightness and saturation must not be negative.");
+        op->kind = STREAM_MODULATE;
+        op->v[0] = 0.01*a; op->v[1] = 0.01*b; op->v[2] = 0.01*c;
+    }
+    else if (strEQ(name, "depth")) {
+        if (!PyArg_ParseTuple(rest, "i:depth", &bits)) goto fail;
+        if ((bits < 1) || (bits > 16))
+            ERRMSG("depth must be 1 to 16 bits.");
+        op->kind = STREAM_DEPTH;
+        op->v[0] = (double) ((1L << bits) - 1);
+    }
+    else {
+        PyErr_Format(PyMagickError, "Unknown stream operation '%.100s'.",
+                     name);
+        goto fail;
+    }
+    Py_DECREF(rest);
+    return 1;
+
+ fail:
+    Py_XDECREF(rest);
+    return 0;
+}
+
+/* Group ops into stages, tabulating each run of per-channel operations
+   when a table per channel is affordable (quantum depth up to 16). */
+static int
+stream_stages(StreamStage *stages, const StreamOp *ops, long nops)
+{
+    long k, first, n=0;
+    unsigned long v;
+    int channel;
+    Quantum *map;
+
+    for (k=0; k < nops; ) {
+        if (!STREAM_PER_CHANNEL(ops[k].kind)) {
+            stages[n].kind = (ops[k].kind == STREAM_THRESHOLD) ? 
+                STREAM_BILEVEL : STREAM_HSL;
+            stages[n].first = k;
+            stages[n].last = k+1;
+            stages[n].map = NULL;
+            stages[n++].level = ops[k++].v[0];
+            continue;
+        }
+        for (first=k; (k < nops) && STREAM_PER_CHANNEL(ops[k].kind); k++);
+        stages[n].kind = STREAM_MAP;
+        stages[n].first = first;
+        stages[n].last = k;
+        stages[n].map = NULL;
+        if (MaxRGB <= 65535UL) {
+            map = (Quantum *) PyMem_Malloc(3*((size_t) MaxRGB + 1)*
+                                           sizeof(Quantum));
+            if (map == NULL) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            for (channel=0; channel < 3; channel++)
+                for (v=0; v <= MaxRGB; v++)
+                    map[channel*((size_t) MaxRGB + 1) + v] = 
+                        stream_run(ops, first, k, channel, (Quantum) v);
+            stages[n].map = map;
+        }
+        n++;
+    }
+    return (int) n;
+}
+
+/* Modulate as ModulateImage() does, in HSL space */
+static void
+stream_modulate(const StreamOp *op, PixelPacket *p)
+{
+    double hue, saturation, luminosity;
+
+    TransformHSL(p->red, p->green, p->blue, &hue, &saturation, &luminosity);
+    luminosity *= op->v[0];
+    if (luminosity > 1.0) luminosity = 1.0;
+    saturation *= op->v[1];
+    if (saturation > 1.0) saturation = 1.0;
+    hue += 0.5*(op->v[2] - 1.0);
+    while (hue < 0.0) hue += 1.0;
+    while (hue > 1.0) hue -= 1.0;
+    HSLTransform(hue, saturation, luminosity, &p->red, &p->green, &p->blue);
+}
+
+/* Run every stage of prog over count pixels in place.  Opacity is left
+   alone. */
+static void
+point_pixels(const PointProgram *prog, PixelPacket *pixels, long count)
+{
+    const StreamStage *stage;
+    const Quantum *map;
+    PixelPacket *p;
+    long x;
+    int k;
+
+    for (k=0; k < prog->nstages; k++) {
+        stage = &prog->stages[k];
+        p = pixels;
+        if (stage->kind == STREAM_BILEVEL) {
+            for (x=0; x < count; x++, p++) {
+                p->red = (STREAM_INTENSITY(p) > stage->level) ? MaxRGB : 0;
+                p->green = p->blue = p->red;
+            }
+        }
+        else if (stage->kind == STREAM_HSL) {
+            for (x=0; x < count; x++, p++)
+                stream_modulate(&prog->ops[stage->first], p);
+        }
+        else if ((map = stage->map) != NULL) {
+            for (x=0; x < count; x++, p++) {
+                p->red = map[p->red];
+                p->green = map[MaxRGB + 1 + (size_t) p->green];
+                p->blue = map[2*((size_t) MaxRGB + 1) + p->blue];
+            }
+        }
+        else {
+            for (x=0; x < count; x++, p++) {
+                p->red = stream_run(prog->ops, stage->first, stage->last, 
+                                    0, p->red);
+                p->green = stream_run(prog->ops, stage->first, stage->last,
+                                      1, p->green);
+                p->blue = stream_run(prog->ops, stage->first, stage->last,
+                                     2, p->blue);
+            }
+        }
+    }
+}
+
+static void
+stream_band(void *arg, long first, long last)
+{
+    StreamJob *job = (StreamJob *) arg;
+    PixelPacket *p;
+    unsigned char *q;
+    Quantum s[4];
+    unsigned int v;
+    long y, x, count = (long) job->columns;
+    int c;
+
+    for (y=first; y < last; y++) {
+        p = job->strip + y*count;
+        point_pixels(&job->prog, p, count);
+        q = job->out + y*job->rowbytes;
+        for (x=0; x < count; x++, p++) {
+            if (job->channels == 1) s[0] = STREAM_INTENSITY(p);
+            else {
+                s[0] = p->red; s[1] = p->green; s[2] = p->blue;
+                s[3] = MaxRGB - p->opacity;
+            }
+            for (c=0; c < job->channels; c++) {
+                if (job->bytes == 1) *q++ = ScaleQuantumToChar(s[c]);
+                else {
+                    v = ScaleQuantumToShort(s[c]);
+                    *q++ = (unsigned char) (v >> 8);
+                    *q++ = (unsigned char) (v & 0xff);
+                }
+            }
+        }
+    }
+}
+
+/* Size the strip from the first frame and write the header */
+static int
+stream_begin(StreamJob *job, const Image *image)
+{
+    int maxval = (job->bytes == 1) ? 255 : 65535, status = 0;
+
+    job->columns = image->columns;
+    job->rows = image->rows;
+    if ((long) job->rows < job->height) job->height = (long) job->rows;
+    switch (job->format) {
+    case STREAM_GRAY: case STREAM_PGM: job->channels = 1; break;
+    case STREAM_RGB: case STREAM_PPM: job->channels = 3; break;
+    case STREAM_RGBA: job->channels = 4; break;
+    default: job->channels = image->matte ? 4 : 3;
+    }
+    job->rowbytes = job->columns*job->channels*job->bytes;
+    job->strip = (PixelPacket *) MagickMalloc(job->height*job->columns*
+                                              sizeof(PixelPacket));
+    job->out = (unsigned char *) MagickMalloc(job->height*job->rowbytes);
+    if ((job->strip == NULL) || (job->out == NULL)) {
+        job->error = "Not enough memory for a strip.";
+        return 0;
+    }
+    if (job->format == STREAM_PGM)
+        status = fprintf(job->file, "P5\n%lu %lu\n%d\n", job->columns, 
+                         job->rows, maxval);
+    else if (job->format == STREAM_PPM)
+        status = fprintf(job->file, "P6\n%lu %lu\n%d\n", job->columns,
+                         job->rows, maxval);
+    else if (job->format == STREAM_PAM)
+        status = fprintf(job->file, "P7\nWIDTH %lu\nHEIGHT %lu\nDEPTH %d\n"\
+                         "MAXVAL %d\nTUPLTYPE %s\nENDHDR\n", job->columns,
+                         job->rows, job->channels, maxval, 
+                         (job->channels == 4) ? "RGB_ALPHA" : "RGB");
+    if (status < 0) {
+        job->error = "Could not write the output file.";
+        return 0;
+    }
+    return 1;
+}
+
+static int
+stream_flush(StreamJob *job)
+{
+    run_row_bands(stream_band, job, job->n, (long) job->columns);
+    if (fwrite(job->out, job->rowbytes, job->n, job->file) != 
+        (size_t) job->n) {
+        job->error = "Could not write the output file.";
+        return 0;
+    }
+    job->n = 0;
+    return 1;
+}
+
+/* ReadStream() handler: count is a whole number of rows of the frame
+   being decoded.  Rows of later frames are skipped. */
+static unsigned int
+stream_rows(const Image *image, const void *pixels, const size_t count)
+{
+    StreamJob *job = _streamjob;
+    const PixelPacket *p = (const PixelPacket *) pixels;
+    size_t left = count;
+
+    if (job->error != NULL) return False;
+    if ((job->strip == NULL) && !stream_begin(job, image)) return False;
+    if (job->y >= job->rows) return True;
+    if ((image->columns != job->columns) || (count % job->columns)) {
+        job->error = "The decoder returned partial rows.";
+        return False;
+    }
+    for (; (left > 0) && (job->y < job->rows); left -= job->columns) {
+        memcpy(job->strip + job->n*job->columns, p, 
+               job->columns*sizeof(PixelPacket));
+        p += job->columns;
+        job->n++;
+        job->y++;
+        if (((job->n == job->height) || (job->y == job->rows)) &&
+            !stream_flush(job)) return False;
+    }
+    return True;
+}
+
+static char doc_stream[] = "(columns, rows) = stream(infile, outfile, "\
+"ops(()), strip(32), format, depth(8))\n\n"\
+" Convert infile to outfile a strip of rows at a time, without ever\n"\
+"   holding the whole image: memory use depends on the strip height and\n"\
+"   the image width only.  infile is a file name; outfile is a file name\n"\
+"   or an open file.  Only the first frame is converted.\n\n"\
+"   ops is a sequence of row-local operations applied in order:\n"\
+"     ('level', black, mid, white)  as img.level()\n"\
+"     ('gamma', R, {G, B})          as img.gamma()\n"\
+"     ('negate',)                   as img.negate()\n"\
+"     ('threshold', level)          two colors on intensity, as\n"\
+"                                   img.threshold(level)\n"\
+"     ('colorize', color, {R, G, B})  as colorize()\n"\
+"     ('modulate', brightness, {saturation, hue})  as img.modulate()\n"\
+"     ('depth', bits)               keep 1 to 16 bits per channel\n\n"\
+"   The output is raw samples, depth (8 or 16) bits each, big-endian:\n"\
+"   format is PGM, PPM, PAM (netpbm) or GRAY, RGB, RGBA (no header).\n"\
+"   It defaults to the outfile extension, or PAM.";
+static PyObject *
+magick_stream(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"infile", "outfile", "ops", "strip", "format",
+                             "depth", NULL};
+    PyObject *outobj, *opsobj=NULL, *seq=NULL;
+    char *infile, *format=NULL, *ext;
+    long strip=32, nops=0, k;
+    int depth=8, nstages=0;
+    StreamOp *ops=NULL;
+    StreamStage *stages=NULL;
+    StreamJob job;
+    ImageInfo *info=NULL;
+    Image *image;
+    FILE *fid=NULL;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
+    memset(&job, 0, sizeof(job));
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "sO|Olsi", kwlist, &infile,
+                                     &outobj, &opsobj, &strip, &format,
+                                     &depth))
+        return NULL;
+    if (strlen(infile) >= MaxTextExtent) ERRMSG("File name is too long.");
+    if (strip < 1) ERRMSG("strip must be at least one row.");
+    if ((depth != 8) && (depth != 16)) ERRMSG("depth must be 8 or 16.");
+    if ((format == NULL) && PyString_Check(outobj)) {
+        ext = strrchr(PyString_AS_STRING(outobj), '.');
+        for (k=0; (ext != NULL) && StreamFormats[k]; k++)
+            if (LocaleCompare(ext+1, StreamFormats[k]) == 0) format = ext+1;
+    }
+    job.format = STREAM_PAM;
+    if (format != NULL) {
+        for (k=0; StreamFormats[k]; k++)
+            if (LocaleCompare(format, StreamFormats[k]) == 0) break;
+        if (StreamFormats[k] == NULL) 
+            ERRMSG("format must be GRAY, RGB, RGBA, PGM, PPM or PAM.");
+        job.format = (int) k;
+    }
+
+    if (opsobj != NULL) {
+        seq = PySequence_Fast(opsobj, "ops must be a sequence of tuples.");
+        if (seq == NULL) goto fail;
+        nops = PySequence_Fast_GET_SIZE(seq);
+    }
+    if (nops > 0) {
+        ops = (StreamOp *) PyMem_Malloc(nops*sizeof(StreamOp));
+        stages = (StreamStage *) PyMem_Malloc(nops*sizeof(StreamStage));
+        if ((ops == NULL) || (stages == NULL)) {
+            PyErr_NoMemory();
+            goto fail;
+        }
+        memset(stages, 0, nops*sizeof(StreamStage));
+        for (k=0; k < nops; k++)
+            if (!stream_parse_op(&ops[k], PySequence_Fast_GET_ITEM(seq, k)))
+                goto fail;
+        nstages = stream_stages(stages, ops, nops);
+        if (nstages < 0) goto fail;
+    }
+
+    if (PyString_Check(outobj)) {
+        fid = fopen(PyString_AS_STRING(outobj), "wb");
+        if (fid == NULL) {
+            PyErr_SetFromErrnoWithFilename(PyExc_IOError, 
+                                           PyString_AS_STRING(outobj));
+            goto fail;
+        }
+        job.file = fid;
+    }
+    else job.file = PyFile_AsFile(outobj);
+    if (job.file == NULL) ERRMSG("outfile must be a file name or a file.");
+    if (_streamlock == NULL) {
+        _streamlock = PyThread_allocate_lock();
+        if (_streamlock == NULL) ERRMSG("Cannot allocate a lock.");
+    }
+
+    job.prog.ops = ops;
+    job.prog.stages = stages;
+    job.prog.nstages = nstages;
+    job.bytes = depth / 8;
+    job.height = strip;
+    info = CloneImageInfo((ImageInfo *)NULL);
+    (void) strcpy(info->filename, infile);
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(_streamlock, 1);
+    _streamjob = &job;
+    image = ReadStream(info, stream_rows, &exc);
+    _streamjob = NULL;
+    PyThread_release_lock(_streamlock);
+    if (image != NULL) DestroyImageList(image);
+    if ((job.error == NULL) && (fflush(job.file) != 0))
+        job.error = "Could not write the output file.";
+    Py_END_ALLOW_THREADS
+    if (job.error != NULL) ERRMSG(job.error);
+    CHECK_EXC(exc);
+    if ((job.strip == NULL) || (job.y < job.rows))
+        ERRMSG("The image ended before its last row.");
+
+    if (fid != NULL) fclose(fid);
+    for (k=0; k < nops; k++) PyMem_Free(stages[k].map);
+    PyMem_Free(stages);
+    PyMem_Free(ops);
+    Py_XDECREF(seq);
+    MagickFree(job.strip);
+    MagickFree(job.out);
+    DestroyImageInfo(info);
+    DestroyExceptionInfo(&exc);
+    return Py_BuildValue("(ll)", (long) job.columns, (long) job.rows);
+
+ fail:
+    if (fid != NULL) fclose(fid);
+    if (stages != NULL)
+        for (k=0; k < nops; k++) PyMem_Free(stages[k].map);
+    PyMem_Free(stages);
+    PyMem_Free(ops);
+    Py_XDECREF(seq);
+    MagickFree(job.strip);
+    MagickFree(job.out);
+    if (info) DestroyImageInfo(info);
+    DestroyExceptionInfo(&exc);
+    return NULL;
+}
+
+
+/*
+  Header scanning.
+
+  ping() runs PingImage() over a list of paths in bands handled by
+  magick.workers() threads.  Only the numbers and format names are kept,
+  one PingRecord per path, so no image objects or attribute lookups are
+  made.
+*/
+#define PING_FIELDS 5
+
+typedef struct {
+    long fields[PING_FIELDS];   /* columns, rows, frames, colorspace */
+    char magick[32];            /* format name, "" if unreadable */
+} PingRecord;
+
+typedef struct {
+    const ImageInfo *info;
+    char **paths;
+    PingRecord *records;
+} PingJob;
+
+static void
+ping_band(void *arg, long first, long last)
+{
+    PingJob *job = (PingJob *) arg;
+    PingRecord *rec;
+    ImageInfo *info;
+    Image *image;
+    ExceptionInfo exception;
+    long k;
+
+    info = CloneImageInfo(job->info);
+    for (k=first; k < last; k++) {
+        rec = &job->records[k];
+        memset(rec, 0, sizeof(PingRecord));
+        if ((info == NULL) || (strlen(job->paths[k]) >= MaxTextExtent))
+            continue;
+        (void) strcpy(info->filename, job->paths[k]);
+        GetExceptionInfo(&exception);
+        image = PingImage(info, &exception);
+        if (image != NULL) {
+            rec->fields[0] = (long) image->columns;
+            rec->fields[1] = (long) image->rows;
+            rec->fields[2] = (long) GetImageListLength(image);
+            rec->fields[3] = (long) image->colorspace;
+            strncpy(rec->magick, image->magick, sizeof(rec->magick)-1);
+            DestroyImageList(image);
+        }
+        DestroyExceptionInfo(&exception);
+    }
+    if (info) DestroyImageInfo(info);
+}
+
+static char doc_ping[] = "(records, formats) = ping(paths, <keywords>)\n\n"\
+" Read only the headers of the files named in paths and return an\n"\
+"   N x 5 integer array with one row per path:\n"\
+"     columns, rows, frames, colorspace, format\n"\
+"   colorspace indexes magick.colorspaces and format indexes the list of\n"\
+"   format names returned with it.  Files that cannot be read get a row\n"\
+"   of zeros with format -1.  The paths are split over magick.workers()\n"\
+"   threads with the interpreter lock released.  Keywords are read\n"\
+"   options as for image().";
+static PyObject *
+magick_ping(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *pathsobj, *seq=NULL, *item, *formats=NULL, *names=NULL;
+    PyObject *records=NULL, *index;
+    PingJob job;
+    ImageInfo *info=NULL;
+    long *out;
+    long k, count;
+    int dims[2], f;
+
+    job.paths = NULL;
+    job.records = NULL;
+    if (!PyArg_ParseTuple(args, "O", &pathsobj)) return NULL;
+    seq = PySequence_Fast(pathsobj, "paths must be a sequence of strings.");
+    if (seq == NULL) return NULL;
+    count = PySequence_Fast_GET_SIZE(seq);
+    info = CloneImageInfo((ImageInfo *)NULL);
+    if ((kwds) && !update_info_from_kwds(info, kwds)) goto fail;
+    info->ping = True;
+    job.info = info;
+    job.paths = (char **) PyMem_Malloc((count+1)*sizeof(char *));
+    job.records = (PingRecord *) PyMem_Malloc((count+1)*sizeof(PingRecord));
+    if ((job.paths == NULL) || (job.records == NULL)) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    for (k=0; k < count; k++) {
+        item = PySequence_Fast_GET_ITEM(seq, k);
+        if (!PyString_Check(item)) ERRMSG("paths must be strings.");
+        job.paths[k] = PyString_AS_STRING(item);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    run_bands(ping_band, &job, count, _workers);
+    Py_END_ALLOW_THREADS
+
+    dims[0] = (int) count;
+    dims[1] = PING_FIELDS;
+    records = PyArray_FromDims(2, dims, PyArray_LONG);
+    formats = PyDict_New();
+    names = PyList_New(0);
+    if ((records == NULL) || (formats == NULL) || (names == NULL)) goto fail;
+    out = (long *) DATA(records);
+    for (k=0; k < count; k++, out += PING_FIELDS) {
+        memcpy(out, job.records[k].fields, sizeof(job.records[k].fields));
+        out[PING_FIELDS-1] = -1;
+        if (job.records[k].magick[0] == '\0') continue;
+        index = PyDict_GetItemString(formats, job.records[k].magick);
+        if (index == NULL) {
+            f = (int) PyList_GET_SIZE(names);
+            item = PyString_FromString(job.records[k].magick);
+            if ((item == NULL) || (PyList_Append(names, item) < 0)) {
+                Py_XDECREF(item);
+                goto fail;
+            }
+            Py_DECREF(item);
+            index = PyInt_FromLong(f);
+            if ((index == NULL) || (PyDict_SetItemString(formats, 
+                                      job.records[k].magick, index) < 0)) {
+                Py_XDECREF(index);
+                goto fail;
+            }
+            Py_DECREF(index);
+        }
+        out[PING_FIELDS-1] = PyInt_AS_LONG(index);
+    }
+
+    Py_DECREF(formats);
+    Py_DECREF(seq);
+    PyMem_Free(job.paths);
+    PyMem_Free(job.records);
+    DestroyImageInfo(info);
+    return Py_BuildValue("(NN)", records, names);
+
+ fail:
+    Py_XDECREF(records);
+    Py_XDECREF(formats);
+    Py_XDECREF(names);
+    Py_XDECREF(seq);
+    PyMem_Free(job.paths);
+    PyMem_Free(job.records);
+    if (info) DestroyImageInfo(info);
+    return NULL;
+}
+
+
+/*
+  Lazy pipelines.
+
+  lazy(src) records operations and runs them only when the result is
+  asked for.  Adjacent point operations are compiled into one
+  PointProgram (runs of per-channel operations become one table each)
+  and applied in a single pass, in place, to an image the pipeline
+  owns, so they make no intermediate images.  Other steps call the
+  module-level function of that name; only the latest intermediate is
+  kept alive.
+*/
+typedef struct {
+    PyObject_HEAD
+    PyObject *source;   /* image, file name, file or array */
+    PyObject *steps;    /* list of (function, args); None: point op */
+} PyPipelineObject;
+
+#define ASPIPE(p) ((PyPipelineObject *)(p))
+
+static char *PointOpNames[] = {"level", "gamma", "negate", "threshold", 
+                               "colorize", "modulate", "depth", NULL};
+
+typedef struct {
+    const PointProgram *prog;
+    PixelPacket *pixels;
+    long columns;
+} PointJob;
+
+/* One row at a time, so every stage finds the row still in cache */
+static void
+point_band(void *arg, long first, long last)
+{
+    PointJob *job = (PointJob *) arg;
+    long y;
+
+    for (y=first; y < last; y++)
+        point_pixels(job->prog, job->pixels + y*job->columns, job->columns);
+}
+
+/* Apply prog to one frame in place; errors are left in
+   image->exception */
+static int
+point_frame(Image *image, const PointProgram *prog)
+{
+    PointJob job;
+    PixelPacket *q;
+    long y;
+
+    if (image->storage_class != DirectClass)
+        SetImageType(image, image->matte ? TrueColorMatteType : 
+                     TrueColorType);
+    job.prog = prog;
+    job.columns = (long) image->columns;
+    job.pixels = get_frame_pixels(image);
+    if (job.pixels != NULL) {
+        run_row_bands(point_band, &job, (long) image->rows, job.columns);
+        return SyncImagePixels(image);
+    }
+    for (y=0; y < (long) image->rows; y++) {
+        q = GetImagePixels(image, 0, y, image->columns, 1);
+        if (q == NULL) return False;
+        point_pixels(prog, q, job.columns);
+        if (!SyncImagePixels(image)) return False;
+    }
+    return True;
+}
+
+/* A new image object the pipeline may change in place */
+static PyObject *
+pipeline_copy(PyObject *obj)
+{
+    PyMImageObject *new;
+    ImageInfo *info;
+    Image *im;
+
+    info = CloneImageInfo((ImageInfo *)NULL);
+    im = _convert_object(obj, info);
+    DestroyImageInfo(info);
+    if (im == NULL) return NULL;
+    new = mimage_alloc();
+    if (new == NULL) {
+        DestroyImageList(im);
+        return NULL;
+    }
+    new->ims = im;
+    return (PyObject *)new;
+}
+
+/* Apply steps [first,last), all point operations, to *cur */
+static int
+pipeline_points(PyPipelineObject *self, PyObject **cur, long first, 
+                long last)
+{
+    PyObject *new;
+    StreamOp *ops=NULL;
+    StreamStage *stages=NULL;
+    PointProgram prog;
+    Image *mag;
+    long k, n = last - first;
+
+    ops = (StreamOp *) PyMem_Malloc(n*sizeof(StreamOp));
+    stages = (StreamStage *) PyMem_Malloc(n*sizeof(StreamStage));
+    if ((ops == NULL) || (stages == NULL)) {
+        PyErr_NoMemory();
+        goto fail;
+    }
+    memset(stages, 0, n*sizeof(StreamStage));
+    for (k=0; k < n; k++)
+        if (!stream_parse_op(&ops[k], PyTuple_GET_ITEM(
+                     PyList_GET_ITEM(self->steps, first+k), 1))) goto fail;
+    prog.ops = ops;
+    prog.stages = stages;
+    prog.nstages = stream_stages(stages, ops, n);
+    if (prog.nstages < 0) goto fail;
+
+    /* The source and anything a step handed back that is also held
+       elsewhere are copied before being changed. */
+    if ((*cur == NULL) || ((*cur)->ob_refcnt > 1)) {
+        new = pipeline_copy(*cur ? *cur : self->source);
+        if (new == NULL) goto fail;
+        Py_XDECREF(*cur);
+        *cur = new;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    for (mag=ASIM(*cur)->ims; mag; mag=mag->next)
+        if (!point_frame(mag, &prog)) break;
+    Py_END_ALLOW_THREADS
+    if (mag != NULL) {
+        CHECK_ERR_IM(mag);
+        ERRMSG("Cannot update the image pixels.");
+    }
+
+    for (k=0; k < n; k++) PyMem_Free(stages[k].map);
+    PyMem_Free(stages);
+    PyMem_Free(ops);
+    return 1;
+
+ fail:
+    if (stages != NULL)
+        for (k=0; k < n; k++) PyMem_Free(stages[k].map);
+    PyMem_Free(stages);
+    PyMem_Free(ops);
+    return 0;
+}
+
+/* Run the pipeline and return a new image object */
+static PyObject *
+pipeline_execute(PyPipelineObject *self)
+{
+    PyObject *cur=NULL, *step, *func, *stepargs, *callargs, *new, *item;
+    long k, j, i, nsteps;
+
+    nsteps = PyList_GET_SIZE(self->steps);
+    for (k=0; k < nsteps; k=j) {
+        step = PyList_GET_ITEM(self->steps, k);
+        func = PyTuple_GET_ITEM(step, 0);
+        if (func == Py_None) {
+            for (j=k; (j < nsteps) && (PyTuple_GET_ITEM(
+                       PyList_GET_ITEM(self->steps, j), 0) == Py_None); j++);
+            if (!pipeline_points(self, &cur, k, j)) goto fail;
+            continue;
+        }
+        stepargs = PyTuple_GET_ITEM(step, 1);
+        callargs = PyTuple_New(PyTuple_GET_SIZE(stepargs) + 1);
+        if (callargs == NULL) goto fail;
+        item = cur ? cur : self->source;
+        Py_INCREF(item);
+        PyTuple_SET_ITEM(callargs, 0, item);
+        for (i=0; i < PyTuple_GET_SIZE(stepargs); i++) {
+            item = PyTuple_GET_ITEM(stepargs, i);
+            Py_INCREF(item);
+            PyTuple_SET_ITEM(callargs, i+1, item);
+        }
+        new = PyObject_Call(func, callargs, NULL);
+        Py_DECREF(callargs);
+        if (new == NULL) goto fail;
+        if (!PyMImage_Check(new)) {
+            Py_DECREF(new);
+            ERRMSG("Pipeline steps must return an image.");
+        }
+        Py_XDECREF(cur);
+        cur = new;
+        j = k+1;
+    }
+    if (cur == NULL) cur = pipeline_copy(self->source);
+    return cur;
+
+ fail:
+    Py_XDECREF(cur);
+    return NULL;
+}
+
+static char doc_then_pipeline[] = "p.then(op, *args)\n\n"\
+" Add a step and return the pipeline.  op is a point operation name\n"\
+"   (level, gamma, negate, threshold, colorize, modulate, depth, with the\n"\
+"   arguments described for stream()), the name of a module-level\n"\
+"   function such as 'resize', or any callable taking the image first\n"\
+"   and returning a new image.";
+static PyObject *
+then_pipeline(PyObject *self, PyObject *args)
+{
+    PyObject *op, *func, *rest, *step;
+    StreamOp check;
+    char *name;
+    int k;
+
+    if (PyTuple_GET_SIZE(args) < 1) ERRMSG("then() needs an operation.");
+    op = PyTuple_GET_ITEM(args, 0);
+    if (PyString_Check(op)) {
+        name = PyString_AS_STRING(op);
+        for (k=0; PointOpNames[k]; k++)
+            if (strEQ(name, PointOpNames[k])) break;
+        if (PointOpNames[k] != NULL) {
+            if (!stream_parse_op(&check, args)) return NULL;
+            step = Py_BuildValue("(OO)", Py_None, args);
+            goto add;
+        }
+        func = PyObject_GetAttr(PyImport_AddModule("magick"), op);
+        if (func == NULL) return NULL;
+    }
+    else {
+        func = op;
+        Py_INCREF(func);
+    }
+    if (!PyCallable_Check(func)) {
+        Py_DECREF(func);
+        ERRMSG("op must be an operation name or a callable.");
+    }
+    rest = PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args));
+    if (rest == NULL) {
+        Py_DECREF(func);
+        return NULL;
+    }
+    step = Py_BuildValue("(NN)", func, rest);
+
+ add:
+    if (step == NULL) return NULL;
+    if (PyList_Append(ASPIPE(self)->steps, step) < 0) {
+        Py_DECREF(step);
+        return NULL;
+    }
+    Py_DECREF(step);
+    Py_INCREF(self);
+    return self;
+
+ fail:
+    return NULL;
+}
+
+static char doc_run_pipeline[] = "img = p.run()\n\n"\
+" Run the steps on the source and return the resulting image.  The\n"\
+"   source is read each time the pipeline runs and is never changed.";
+static PyObject *
+run_pipeline(PyObject *self, PyObject *args)
+{
+    return pipeline_execute(ASPIPE(self));
+}
+
+/* Run the pipeline and call the image method name on the result */
+static PyObject *
+pipeline_finish(PyObject *self, char *name, PyObject *args, PyObject *kwds)
+{
+    PyObject *img, *meth, *result;
+
+    img = pipeline_execute(ASPIPE(self));
+    if (img == NULL) return NULL;
+    meth = PyObject_GetAttrString(img, name);
+    Py_DECREF(img);
+    if (meth == NULL) return NULL;
+    result = PyObject_Call(meth, args, kwds);
+    Py_DECREF(meth);
+    return result;
+}
+
+static PyObject *
+write_pipeline(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    return pipeline_finish(self, "write", args, kwds);
+}
+
+static PyObject *
+tobytes_pipeline(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    return pipeline_finish(self, "tobytes", args, kwds);
+}
+
+static PyObject *
+toarray_pipeline(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    return pipeline_finish(self, "toarray", args, kwds);
+}
+
+static PyMethodDef pipeline_methods[] = {
+    {"then", (PyCFunction)then_pipeline, METH_VARARGS, doc_then_pipeline},
+    {"run", (PyCFunction)run_pipeline, METH_NOARGS, doc_run_pipeline},
+    {"write", (PyCFunction)write_pipeline, METH_VARARGS|METH_KEYWORDS,
+     "p.write(...)\n\n Run the pipeline and write the result, as img.write()."},
+    {"tobytes", (PyCFunction)tobytes_pipeline, METH_VARARGS|METH_KEYWORDS,
+     "p.tobytes(...)\n\n Run the pipeline and encode the result, as "\
+     "img.tobytes()."},
+    {"toarray", (PyCFunction)toarray_pipeline, METH_VARARGS|METH_KEYWORDS,
+     "p.toarray(...)\n\n Run the pipeline and return the result as an "\
+     "array, as img.toarray()."},
+    {NULL, NULL}
+};
+
+static void
+pipeline_dealloc(PyObject *self)
+{
+    Py_XDECREF(ASPIPE(self)->source);
+    Py_XDECREF(ASPIPE(self)->steps);
+    PyObject_Del(self);
+}
+
+static PyObject *
+pipeline_getattr(PyObject *self, char *name)
+{
+    return Py_FindMethod(pipeline_methods, self, name);
+}
+
+static PyTypeObject Pipeline_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                                
+    "MagickPipeline",                  /* tp_name */
+    sizeof(PyPipelineObject),          /* tp_basicsize */
+    0,                                 /* tp_itemsize */
+    (destructor)pipeline_dealloc,      /* tp_dealloc */
+    0,          /* tp_print*/
+    (getattrfunc)pipeline_getattr,     /* tp_getattr*/
+    0,          /* tp_setattr*/
+    0,          /* tp_compare*/
+    0,          /* tp_repr*/
+    0,          /* tp_as_number*/
+    0,          /* tp_as_sequence*/
+    0,          /* tp_as_mapping*/
+    0,          /* tp_hash */
+    0,          /* tp_call */
+    0,          /* tp_str */
+    0,          /* tp_getattro */
+    0,          /* tp_setattro */
+    0,          /* tp_as_buffer */
+    0,          /* tp_flags */
+    "Operations recorded to run on an image later",  /* tp_doc */
+};
+
+static char doc_lazy[] = "p = lazy(src)\n\n"\
+" Return a pipeline that records operations on src (an image, file\n"\
+"   name, file or array) without running them:\n\n"\
+"   lazy('in.jpg').then('resize', 800, 600).then('sharpen', 1.0)\\\n"\
+"       .then('gamma', 1.2).then('level', 0.05).write('out.png')\n\n"\
+"   The steps run when p.run(), p.write(), p.tobytes() or p.toarray()\n"\
+"   is called.  Adjacent point operations are applied together in one\n"\
+"   pass over the pixels, in place, and each intermediate image is freed\n"\
+"   as soon as the next step has run.  A file name source is handed to\n"\
+"   the first step as is, so resize() and thumbnail() can shrink on load.";
+static PyObject *
+magick_lazy(PyObject *self, PyObject *src)
+{
+    PyPipelineObject *new;
+
+    new = PyObject_New(PyPipelineObject, &Pipeline_Type);
+    if (new == NULL) return NULL;
+    Py_INCREF(src);
+    new->source = src;
+    new->steps = PyList_New(0);
+    if (new->steps == NULL) {
+        Py_DECREF(new);
+        return NULL;
+    }
+    return (PyObject *)new;
+}
+
+
+/*
+  Frame-parallel filters.
+
+  Each module-level filter hands filter_frames() a FrameOp that filters
+  one frame.  With frameworkers(n) > 1 the frames of a sequence are split
+  into n contiguous runs filtered on their own threads; the results are
+  linked back in frame order.  Every frame gets the same arguments as in
+  the serial loop, so the output does not depend on n.
+*/
+typedef struct {
+    double rad, sig, x, y;
+    long columns, rows;
+    int n;
+    const void *info;
+    PixelPacket color;
+} FrameArgs;
+
+typedef Image *(*FrameOp)(const Image *, const FrameArgs *, ExceptionInfo *);
+
+#define FRAME_OP(name, call) \
+static Image * \
+name(const Image *mag, const FrameArgs *a, ExceptionInfo *exc) \
+{ \
+    return (call); \
+}
+
+static int _frameworkers = 1;
+
+typedef struct {
+    FrameOp op;
+    const FrameArgs *args;
+    Image **frames;
+    ExceptionInfo *excs;
+} FrameJobs;
+
+/* Filter frames [first,last) in order, stopping at the first failure.
+   Frame k reports to excs[k]; frames after a failure come back NULL. */
+static void
+frame_band(void *arg, long first, long last)
+{
+    FrameJobs *jobs = (FrameJobs *) arg;
+    long k;
+
+    for (k=first; k < last; k++) {
+        jobs->frames[k] = jobs->op(jobs->frames[k], jobs->args, 
+                                   &jobs->excs[k]);
+        if (MAGICK_FAILED(jobs->excs[k])) break;
+    }
+    for (k++; k < last; k++) jobs->frames[k] = NULL;
+}
+
+/* Apply op to every frame of images and return the new list.  On error
+   the exception is set and the frames made so far are returned, as in
+   the serial loop.  Runs without the interpreter lock. */
+static Image *
+filter_frames(Image *images, FrameOp op, const FrameArgs *args,
+              ExceptionInfo *exception)
+{
+    Image *mag, *new = NewImageList();
+    FrameJobs jobs;
+    ExceptionInfo frame;
+    long k, count;
+
+    count = (long) GetImageListLength(images);
+    jobs.frames = NULL;
+    jobs.excs = NULL;
+    if ((_frameworkers > 1) && (count > 1)) {
+        jobs.frames = (Image **) MagickMalloc(count*sizeof(Image *));
+        jobs.excs = (ExceptionInfo *) MagickMalloc(count*
+                                                   sizeof(ExceptionInfo));
+    }
+    if ((jobs.frames == NULL) || (jobs.excs == NULL)) {
+        MagickFree(jobs.frames);
+        MagickFree(jobs.excs);
+        for (mag=images; mag; mag=mag->next) {
+            GetExceptionInfo(&frame);
+            AppendImageToList(&new, op(mag, args, &frame));
+            keep_exception(exception, &frame);
+            DestroyExceptionInfo(&frame);
+            if (MAGICK_FAILED(*exception)) break;
+        }
+        return new;
+    }
+
+    jobs.op = op;
+    jobs.args = args;
+    for (k=0, mag=images; k < count; k++, mag=mag->next) {
+        jobs.frames[k] = mag;
+        GetExceptionInfo(&jobs.excs[k]);
+    }
+    run_bands(frame_band, &jobs, count, _frameworkers);
+
+    /* Link the frames in order up to the first error, as the serial loop
+       would have; report that error, or else the first warning. */
+    for (k=0; k < count; k++) {
+        if (MAGICK_FAILED(*exception)) {
+            if (jobs.frames[k]) DestroyImage(jobs.frames[k]);
+        }
+        else {
+            AppendImageToList(&new, jobs.frames[k]);
+            keep_exception(exception, &jobs.excs[k]);
+        }
+        DestroyExceptionInfo(&jobs.excs[k]);
+    }
+    MagickFree(jobs.frames);
+    MagickFree(jobs.excs);
+    return new;
+}
+
+static char doc_imagecache[] = "stats = imagecache(<maxbytes>)\n\n"\
+" Return a dictionary describing the decoded-image cache: maxbytes,\n"\
+"   bytes, entries, hits and misses.  If maxbytes is given, first limit\n"\
+"   the cache to that many bytes of pixels; 0 (the default) empties and\n"\
+"   disables it.  While enabled, images read from a file name are\n"\
+"   decoded once and callers get copy-on-write clones.";
+static PyObject *
+imagecache(PyObject *self, PyObject *args)
+{
+    long maxbytes = -1;
+
+    if (!PyArg_ParseTuple(args, "|l", &maxbytes)) return NULL;
+    if (maxbytes >= 0) {
+        _cachemax = (size_t) maxbytes;
+        cache_trim(_cachemax);
+        if (_cachemax == 0) _cachehits = _cachemisses = 0;
+    }
+    return Py_BuildValue("{s:l,s:l,s:l,s:l,s:l}", 
+                         "maxbytes", (long) _cachemax,
+                         "bytes", (long) _cachebytes,
+                         "entries", _cacheentries,
+                         "hits", _cachehits, "misses", _cachemisses);
+}
+
+
+static PyObject *
+stat_entry(StatEntry *e)
+{
+    return Py_BuildValue("{s:l,s:l,s:d,s:d,s:N,s:N}", 
+                         "calls", e->calls, "errors", e->errors,
+                         "seconds", e->seconds, "max", e->max,
+                         "pixels", PyLong_FromDouble(e->pixels),
+                         "bytes", PyLong_FromDouble(e->bytes));
+}
+
+static char doc_stats[] = "stats = stats(<enable>, reset=0)\n\n"\
+" Return a dictionary of the calls accounted for since the last reset:\n"\
+"   'functions' maps module functions and image methods, 'decode' and\n"\
+"   'encode' map coder names (JPEG, PNG, ...), each to a dictionary of\n"\
+"   calls, errors, seconds (total wall time), max (longest call), pixels\n"\
+"   (of the result, or of img for in-place methods) and bytes (requested\n"\
+"   from the allocator during the calls, each realloc() counting its new\n"\
+"   size, GraphicsMagick 1.2 or later only, not counting pixel caches).  'enabled' is true while accounting is on.  Then, if\n"\
+"   enable is given, switch accounting on or off, and if reset is true\n"\
+"   clear all counters.  Accounting is off by default.";
+static PyObject *
+magick_stats(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"enable", "reset", NULL};
+    int enable = -1, reset = 0;
+    PyObject *res=NULL, *funcs=NULL, *coders[2]={NULL, NULL}, *e;
+    long k;
+    int op;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ii", kwlist, &enable,
+                                     &reset))
+        return NULL;
+    if ((funcs = PyDict_New()) == NULL) goto fail;
+    for (k=0; k < _statcount; k++) {
+        if (_statfuncs[k].calls == 0) continue;
+        if ((e = stat_entry(&_statfuncs[k])) == NULL) goto fail;
+        if (PyDict_SetItemString(funcs, _statorig[k]->ml_name, e) < 0) {
+            Py_DECREF(e);
+            goto fail;
+        }
+        Py_DECREF(e);
+    }
+    for (op=0; op < 2; op++) {
+        if ((coders[op] = PyDict_New()) == NULL) goto fail;
+        for (k=0; k < _statncoders; k++) {
+            if (_statcoders[k].entry[op].calls == 0) continue;
+            if ((e = stat_entry(&_statcoders[k].entry[op])) == NULL) 
+                goto fail;
+            if (PyDict_SetItemString(coders[op], _statcoders[k].name, e) < 0) {
+                Py_DECREF(e);
+                goto fail;
+            }
+            Py_DECREF(e);
+        }
+    }
+    res = Py_BuildValue("{s:i,s:N,s:N,s:N}", "enabled", _statson,
+                        "functions", funcs, "decode", coders[STAT_DECODE],
+                        "encode", coders[STAT_ENCODE]);
+    funcs = coders[0] = coders[1] = NULL;
+    if (res == NULL) goto fail;
+
+    if (enable >= 0) _statson = (enable != 0);
+    if (reset) {
+        if (_statcount > 0) 
+            memset(_statfuncs, 0, _statcount*sizeof(StatEntry));
+        _statncoders = 0;
+    }
+    return res;
+
+ fail:
+    Py_XDECREF(funcs);
+    Py_XDECREF(coders[0]);
+    Py_XDECREF(coders[1]);
+    return NULL;
+}
+
+
+static char doc_frameworkers[] = "n = frameworkers(<n>)\n\n"\
+" Return the number of threads the module-level filters use for the\n"\
+"   frames of a sequence.  If n is given (1 to 64) use that many first.\n"\
+"   The default of 1 filters one frame at a time.";
+static PyObject *
+frameworkers(PyObject *self, PyObject *args)
+{
+    int n = 0;
+
+    if (!PyArg_ParseTuple(args, "|i", &n)) return NULL;
+    if (n != 0) {
+        if ((n < 1) || (n > MAX_WORKERS)) {
+            PyErr_Format(PyExc_ValueError, "Number of workers must be "
+                         "between 1 and %d.", MAX_WORKERS);
+            return NULL;
+        }
+        _frameworkers = n;
+    }
+    return PyInt_FromLong(_frameworkers);
+}
+
+
+FRAME_OP(magnify_op, MagnifyImage(mag, exc))
+
 static char doc_magnify_image[] = "out = magnify(img)\n\nMagnify an image to twice its size.";
 static PyObject *
 magnify_image(PyObject *self, PyObject *obj)
 {
     PyObject *imobj=NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
-    
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, MagnifyImage(mag, &exception));
-        CHECK_ERR;
-    }
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, magnify_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;   
 }
 
 
+FRAME_OP(minify_op, MinifyImage(mag, exc))
+
 static char doc_minify_image[] = "out = minify(img)\n\nMinify an image to half its size.";
 static PyObject *
 minify_image(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
-    Image *mag;
     PyMImageObject *new = NULL;
-    
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, MinifyImage(mag, &exception));
-        CHECK_ERR;
-    }
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, minify_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;    
@@ -6751,26 +9991,49 @@ get_rows_cols(Image *im, PyObject *robj, PyObject *cobj, long *rows, long *cols)
     
 }
 
+/* The size asked for by the (rows, columns) objects of resize() and
+   thumbnail() that is known before the image is read: 0 where it depends
+   on the image (< 0 to keep the aspect ratio).  If either side is a
+   factor both are 0, since the factor applies to the full size and a
+   smaller decode would shrink the result. */
+static void
+requested_size(PyObject *robj, PyObject *cobj, long *rows, long *cols)
+{
+    *rows = *cols = 0;
+    if (!PyInt_Check(robj) || !PyInt_Check(cobj)) return;
+    *rows = PyInt_AS_LONG(robj);
+    *cols = PyInt_AS_LONG(cobj);
+    if (*rows < 0) *rows = 0;
+    if (*cols < 0) *cols = 0;
+}
+
+FRAME_OP(resize_op,
+         ResizeImage(mag, a->columns, a->rows, (FilterTypes) a->n, a->x, exc))
+
 static char doc_resize_image[] = "out = resize(img, (rows, columns) {,blur, filter}) \n\n"\
 "  Resize an image to an arbitrary shape using a blur factor (>1 is blurry, \n"\
 "   <1 is sharp) and a filter: 'Lanczos' (default), 'Bessel', 'Catrom', \n"\
 "   'Hanning', 'Mitchell', 'Sinc', 'Blackman', 'Cubic', 'Hermite', \n"\
 "   'Point', 'Triangle', 'Box', 'Gaussian', 'Quadratic'\n\n"\
 "  If rows or columsn is <0 then keep aspect ratio.  If they are not integers\n"\
-"    then treat as factors to multiply by the current size.";
+"    then treat as factors to multiply by the current size.\n\n"\
+"  A file name or stream is decoded no larger than needed when the\n"\
+"    codec supports it (JPEG).";
 static PyObject *
 resize_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     char *str = NULL;
     PyObject *rows_obj, *cols_obj;
     long rows, cols;
     double blur = 0.9;
     int ind;
-        
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(OO)|ds",&obj, &rows_obj, &cols_obj, 
              &blur, &str)) return NULL;
     if (str == NULL) str = "Lanczos";
@@ -6778,29 +10041,37 @@ resize_image(PyObject *self, PyObject *args)
     PyErr_Format(PyMagickError, "Unrecognized Filter Type: %s", str);
     return NULL;
     }
-    if ((imobj = mimage_from_object(obj))==NULL) return NULL;
+    /* Decode no larger than needed; the filter still does the resize */
+    requested_size(rows_obj, cols_obj, &rows, &cols);
+    if ((imobj = mimage_from_object_sized(obj, cols, rows))==NULL) 
+        return NULL;
     if (!get_rows_cols(ASIM(imobj)->ims, rows_obj, cols_obj, &rows, &cols)) 
         goto fail;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ResizeImage(mag, cols, rows, 
-                        (FilterTypes)ind, blur, 
-                        &exception));
-        CHECK_ERR;
-    }
+    opargs.columns = cols;
+    opargs.rows = rows;
+    opargs.n = ind;
+    opargs.x = blur;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, resize_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);    
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;    
 }
 
 
+FRAME_OP(sample_op, SampleImage(mag, a->columns, a->rows, exc))
+
 static char doc_sample_image[] = "out = sample(img, (rows, columns)) \n\n"\
 "  Resample an image to an arbitrary shape using pixel sampling.\n"\
 "    No additional colors are introduced into the image.\n"\
@@ -6813,7 +10084,10 @@ sample_image(PyObject *self, PyObject *args)
     Image *mag;
     PyMImageObject *new=NULL;
     long rows, cols;
-        
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(ll)",&obj, &rows, &cols)) return NULL;
     if (rows*cols == 0) ERRMSG("Negative shape not allowed");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -6823,26 +10097,30 @@ sample_image(PyObject *self, PyObject *args)
     if (cols < 0) /* Keep scale factor */
         cols = mag->columns * ((double) (rows) / (double) (mag->rows)) + 0.5;
     if (rows < 0) /* Keep scale factor */
-        rows = mag->rows * ((double) (cols) / (double) (mag->columns)) + 0.5;
-
-    new = PyObject_New(PyMImageObject, &MImage_Type);
-    if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, SampleImage(mag, cols, rows, 
-                         &exception));
-        CHECK_ERR;
-    }
+        rows = mag->rows * ((double) (cols) / (double) (mag->columns)) + 0.5;
+
+    new = mimage_alloc();
+    if (new == NULL) goto fail; 
+    opargs.columns = cols;
+    opargs.rows = rows;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, sample_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj); 
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;    
 }
 
 
+FRAME_OP(scale_op, ScaleImage(mag, a->columns, a->rows, exc))
+
 static char doc_scale_image[] = "out = scale(img, (rows, columns)) \n\n"\
 "  Scale an image to an arbitrary shape.\n"\
 "  If rows or columns < 0, then keep aspect ratio.";
@@ -6854,7 +10132,10 @@ scale_image(PyObject *self, PyObject *args)
     Image *mag;
     PyMImageObject *new=NULL;
     long rows, cols;
-        
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(ll)",&obj, &rows, &cols)) return NULL;
     if (rows*cols == 0) ERRMSG("Negative shape not allowed");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -6865,58 +10146,73 @@ scale_image(PyObject *self, PyObject *args)
         cols = mag->columns * ((double) (rows) / (double) (mag->rows)) + 0.5;
     if (rows < 0) /* Keep scale factor */
         rows = mag->rows * ((double) (cols) / (double) (mag->columns)) + 0.5;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ScaleImage(mag, cols, rows, 
-                        &exception));
-        CHECK_ERR;
-    }
+    opargs.columns = cols;
+    opargs.rows = rows;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, scale_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj); 
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;    
 }
 
+FRAME_OP(thumbnail_op, ThumbnailImage(mag, a->columns, a->rows, exc))
+
 static char doc_thumbnail_image[] = "out = thumbnail(img, (rows, columns)) \n\n"\
 "  Scale an image -- particularly to create a thumbnail.\n\n"\
 "  If rows or columsn is <0 then keep aspect ratio.  If they are not integers\n"\
-"    then treat as factors to multiply by the current size.";
+"    then treat as factors to multiply by the current size.\n\n"\
+"  A file name or stream is decoded no larger than needed when the\n"\
+"    codec supports it (JPEG).";
 static PyObject *
 thumbnail_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     PyObject *rows_obj, *cols_obj;
     long rows, cols;
-        
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(OO)",&obj, &rows_obj, &cols_obj)) return NULL;
-    if ((imobj = mimage_from_object(obj))==NULL) return NULL;
+    /* Decode no larger than needed; the filter still does the resize */
+    requested_size(rows_obj, cols_obj, &rows, &cols);
+    if ((imobj = mimage_from_object_sized(obj, cols, rows))==NULL) 
+        return NULL;
     if (!get_rows_cols(ASIM(imobj)->ims, rows_obj, cols_obj, &rows, &cols)) 
         goto fail;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ThumbnailImage(mag, cols, rows, 
-                            &exception));
-        CHECK_ERR;
-    }
+    opargs.columns = cols;
+    opargs.rows = rows;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, thumbnail_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj); 
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(chop_op, ChopImage(mag, (const RectangleInfo *) a->info, exc))
+
 static char doc_chop_image[] = "out = chop(img, (left,columns,upper,rows)) \n\n"\
 "  Chop an image:  remove rows and columns from the image. \n"\
 "                  left     the leftmost column to remove \n"\
@@ -6929,11 +10225,13 @@ chop_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     long left, upper, columns, rows;
     RectangleInfo rect;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(llll)",&obj, &left, &columns,
               &upper, &rows)) return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -6943,17 +10241,19 @@ chop_image(PyObject *self, PyObject *args)
     rect.x = left;
     rect.y = upper;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ChopImage(mag, &rect, &exception));
-        CHECK_ERR;
-    }
+    opargs.info = &rect;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, chop_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -6968,17 +10268,23 @@ coalesce_images(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = CoalesceImages(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = CoalesceImages(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -6992,22 +10298,30 @@ deconstruct_images(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = DeconstructImages(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = DeconstructImages(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(crop_op, CropImage(mag, (const RectangleInfo *) a->info, exc))
+
 static char doc_crop_image[] = "out = crop(img, (left,columns,upper,rows)) \n\n"\
 "  Crop an image:  keep only specified rows and columns in the image. \n"\
 "                  left     the leftmost column to keep \n"\
@@ -7019,11 +10333,13 @@ crop_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     long left, upper, columns, rows;
     RectangleInfo rect;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(llll)",&obj, &left, &columns,
               &upper, &rows)) return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -7033,17 +10349,19 @@ crop_image(PyObject *self, PyObject *args)
     rect.x = left;
     rect.y = upper;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, CropImage(mag, &rect, &exception));
-        CHECK_ERR;
-    }
+    opargs.info = &rect;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, crop_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7057,17 +10375,23 @@ flatten_images(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = FlattenImages(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = FlattenImages(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7080,17 +10404,23 @@ flip_image(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = FlipImage(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = FlipImage(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7103,17 +10433,23 @@ flop_image(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = FlopImage(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = FlopImage(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7126,22 +10462,30 @@ mosaic_images(PyObject *self, PyObject *obj)
 {
     PyObject *imobj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = MosaicImages(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = MosaicImages(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(roll_op, RollImage(mag, a->columns, a->rows, exc))
+
 static char doc_roll_image[] = "out = roll(img, (columns,rows)) \n\n"\
 "  Roll an image:  columns  the number of columns to roll\n"\
 "                  rows     the number of rows to roll.\n";
@@ -7150,31 +10494,38 @@ roll_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     long columns, rows;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(ll)",&obj, &columns, &rows))
         return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, RollImage(mag, columns, rows, &exception));
-        CHECK_ERR;
-    }
+    opargs.columns = columns;
+    opargs.rows = rows;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, roll_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(shave_op, ShaveImage(mag, (const RectangleInfo *) a->info, exc))
+
 static char doc_shave_image[] = "out = shave(img, (columns,rows)) \n\n"\
 " Shave an image by deleting rows from both the top and bottom and\n"\
 "    columns from the left and right.";
@@ -7183,11 +10534,13 @@ shave_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     long columns, rows;
     RectangleInfo info;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O(ll)",&obj, &columns, &rows)) 
         return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -7195,23 +10548,28 @@ shave_image(PyObject *self, PyObject *args)
     info.width = columns;
     info.height = rows;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ShaveImage(mag, &info,  &exception));
-        CHECK_ERR;
-    }
+    opargs.info = &info;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, shave_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(affine_op,
+         AffineTransformImage(mag, (const AffineMatrix *) a->info, exc))
+
 static char doc_affine_image[] = "out = affine(img, affine, background=) \n\n"\
 " Transform an image as dictated by the affine sequence. \n"\
 "   The affine sequence is (sx, rx, ry, sy{, tx, ty}) with tx and ty 0 \n"\
@@ -7229,10 +10587,12 @@ affine_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
     PyObject *imobj = NULL, *obj = NULL;
     PyObject *affobj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     AffineMatrix matrix;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "OO",&obj, &affobj))
         return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -7248,25 +10608,28 @@ affine_image(PyObject *self, PyObject *args, PyObject *kwds)
 
     if (!get_affine_matrix(&matrix, affobj)) goto fail;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
 
 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, 
-                          AffineTransformImage(mag, &matrix, &exception));
-        CHECK_ERR;
-    }
+    opargs.info = &matrix;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, affine_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(rotate_op, RotateImage(mag, a->x, exc))
+
 static char doc_rotate_image[] = "out = rotate(img, angle, background=) \n\n"\
 " Rotate image by the given angle.  If angle is positive, then \n"\
 "   clockwise rotation.  If angle is negative, then counter-clockwise \n"\
@@ -7278,10 +10641,12 @@ rotate_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double deg;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Od",&obj, &deg))
         return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -7293,17 +10658,19 @@ rotate_image(PyObject *self, PyObject *args, PyObject *kwds)
                                value) == -1) goto fail;
         }
     }
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, RotateImage(mag, deg, &exception));
-        CHECK_ERR;
-    }
+    opargs.x = deg;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, rotate_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7311,6 +10678,8 @@ rotate_image(PyObject *self, PyObject *args, PyObject *kwds)
 
 
 
+FRAME_OP(shear_op, ShearImage(mag, a->x, a->y, exc))
+
 static char doc_shear_image[] = \
 "out = shear(img, x_shear, y_shear, background=) \n\n"\
 " Shear image by the given angles.  x_shear is measured relative to the\n"\
@@ -7323,10 +10692,12 @@ shear_image(PyObject *self, PyObject *args, PyObject *kwds)
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
     PyObject *tcolor=NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double shx, shy;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Odd|O",&obj, &shx, &shy, &tcolor))
         return NULL;
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
@@ -7340,17 +10711,20 @@ shear_image(PyObject *self, PyObject *args, PyObject *kwds)
         }
     }
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ShearImage(mag, shx, shy, &exception));
-        CHECK_ERR;
-    }
+    opargs.x = shx;
+    opargs.y = shy;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, shear_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7358,6 +10732,9 @@ shear_image(PyObject *self, PyObject *args, PyObject *kwds)
 
 
 
+FRAME_OP(adaptive_op,
+         AdaptiveThresholdImage(mag, a->columns, a->rows, a->x, exc))
+
 static char doc_adaptive_image[] = \
 "out = lat(img, width(3), height(3) offset(0)) \n\n"\
 " Perform local adative thresholding using width x height around pixel.\n"\
@@ -7369,11 +10746,13 @@ adaptive_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     long width=3, height=3;
     double offset=0.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|lld",&obj, &width, &height, &offset))
         return NULL;
     if (!((width > 0)  && (height > 0))) 
@@ -7382,25 +10761,29 @@ adaptive_image(PyObject *self, PyObject *args)
 
     if (offset < 1) offset *= MaxRGB;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, 
-              AdaptiveThresholdImage(mag, width, height, 
-                         offset, &exception));
-        CHECK_ERR;
-    }
+    opargs.columns = width;
+    opargs.rows = height;
+    opargs.x = offset;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, adaptive_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(addnoise_op, AddNoiseImage(mag, (NoiseType) a->n, exc))
+
 static char doc_addnoise_image[] = "out = addnoise(img, type)\n\n"\
 " Add random noise to the image of type: 'uniform', 'gaussian', \n"\
 "   'multiplicative', 'impulse', 'laplacian', 'poisson'.";
@@ -7409,11 +10792,13 @@ addnoise_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     char *ntype=NULL;
     int numtype;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|s",&obj, &ntype))
         return NULL;
 
@@ -7424,24 +10809,27 @@ addnoise_image(PyObject *self, PyObject *args)
         
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, AddNoiseImage(mag, (NoiseType) numtype,
-                           &exception));
-        CHECK_ERR;
-    }
+    opargs.n = numtype;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, addnoise_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(blur_op, BlurImage(mag, a->rad, a->sig, exc))
+
 static char doc_blur_image[] = "out = blur(img, sig{, rad})\n\n"\
 " Blur the image with a Gaussian kernel with standard deviation sig and\n"\
 "   radius, rad.  Both sigma and rad are in pixel units.  If rad not given then\n"\
@@ -7451,27 +10839,32 @@ blur_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0, sig;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Od|d",&obj, &sig, &rad))
         return NULL;
     
     if ((sig <= 0.0) || (rad < 0)) ERRMSG("Sigma and radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, BlurImage(mag, rad, sig, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    opargs.sig = sig;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, blur_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -7479,33 +10872,40 @@ blur_image(PyObject *self, PyObject *args)
 
 
 
+FRAME_OP(despeckle_op, DespeckleImage(mag, exc))
+
 static char doc_despeckle_image[] = "out = despeckle(img)\n\n"\
 " Despeckle an image while preserving edges.";
 static PyObject *
 despeckle_image(PyObject *self, PyObject *obj)
 {
     PyObject *imobj=NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
-    
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, DespeckleImage(mag, &exception));
-        CHECK_ERR;
-    }
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, despeckle_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;   
 }
 
 
+FRAME_OP(edge_op, EdgeImage(mag, a->rad, exc))
+
 static char doc_edge_image[] = "out = edge(img{, rad})\n\n"\
 " Find edges in an image.  rad defines the radius of the convolution filter.\n"\
 "   If rad is not specified a suitable value is chosen.";
@@ -7514,32 +10914,38 @@ edge_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|d",&obj, &rad))
         return NULL;
     
     if ((rad < 0)) ERRMSG("Radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, EdgeImage(mag, rad, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, edge_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(emboss_op, EmbossImage(mag, a->rad, a->sig, exc))
+
 static char doc_emboss_image[] = "out = emboss(img, sig{, rad})\n\n"\
 " Returns an image with a three-dimensional effect.\n"\
 "   Convolution with a Gaussian kernel of the radius, rad and standard deviation\n"\
@@ -7549,59 +10955,71 @@ emboss_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0, sig;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Od|d",&obj, &sig, &rad))
         return NULL;
     
     if ((sig <= 0.0) || (rad < 0)) ERRMSG("Sigma and radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, EmbossImage(mag, rad, sig, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    opargs.sig = sig;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, emboss_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(enhance_op, EnhanceImage(mag, exc))
+
 static char doc_enhance_image[] = "out = enhance(img)\n\n"\
 " Apply a digital filter that improves the quality of a noisy image.";
 static PyObject *
 enhance_image(PyObject *self, PyObject *obj)
 {
     PyObject *imobj=NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
-    
+    FrameArgs opargs;
+    ExceptionInfo exc;
+
+    GetExceptionInfo(&exc);
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail; 
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, EnhanceImage(mag, &exception));
-        CHECK_ERR;
-    }
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, enhance_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;   
 }
 
+FRAME_OP(medianfilter_op, MedianFilterImage(mag, a->rad, exc))
+
 static char doc_medianfilter_image[] = "out = medianfilter(img, rad(0.0))\n\n"\
 " Replace each pixel by the median in a set of neighboring pixels defined\n"\
 "   rad.";
@@ -7610,33 +11028,39 @@ medianfilter_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|d",&obj, &rad))
         return NULL;
     
     if ((rad <= 0.0)) ERRMSG("Radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, MedianFilterImage(mag, rad, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, medianfilter_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(motionblur_op, MotionBlurImage(mag, a->rad, a->sig, a->x, exc))
+
 static char doc_motionblur_image[] = "out = motionblur(img, sig, ang{, rad})\n\n"\
 " Blur the image with a Gaussian kernel with standard deviation sig and\n"\
 "   radius, rad.  Both sigma and rad are in pixel units.  If rad not given then\n"\
@@ -7647,32 +11071,40 @@ motionblur_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0, sig, ang;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Odd|d",&obj, &sig, &ang, &rad))
         return NULL;
     
     if ((sig <= 0.0) || (rad < 0)) ERRMSG("Sigma and radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, MotionBlurImage(mag, rad, sig, ang, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    opargs.sig = sig;
+    opargs.x = ang;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, motionblur_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(reducenoise_op, ReduceNoiseImage(mag, a->rad, exc))
+
 static char doc_reducenoise_image[] = "out = reducenoise(img{, rad})\n\n"\
 " Smooths the contours of an image while still preserving edge information.";
 static PyObject *
@@ -7680,32 +11112,38 @@ reducenoise_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|d",&obj, &rad))
         return NULL;
     
     if ((rad < 0.0)) ERRMSG("Radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ReduceNoiseImage(mag, rad, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, reducenoise_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(shade_op, ShadeImage(mag, a->n, a->x, a->y, exc))
+
 static char doc_shade_image[] = \
 "out = shad(img, azimuth(30.0), elevation(30.0), gray(0))\n\n"\
 " Shines a distant light on an image to create a 3-D effect.  \n"\
@@ -7718,33 +11156,40 @@ shade_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double azimuth=30.0, elevation=30.0;
     int gray = 0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|ddi",&obj, &azimuth, &elevation, &gray))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ShadeImage(mag, gray, azimuth, 
-                        elevation, &exception));
-        CHECK_ERR;
-    }
+    opargs.n = gray;
+    opargs.x = azimuth;
+    opargs.y = elevation;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, shade_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(sharpen_op, SharpenImage(mag, a->rad, a->sig, exc))
+
 static char doc_sharpen_image[] = "out = sharpen(img, sig(1), rad(0))\n\n"\
 " Sharpen a blurry image.  A Gaussian operator is used with standard\n"\
 "   deviation, sig and radius, rad.  If rad is not given it will be\n"\
@@ -7754,32 +11199,39 @@ sharpen_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0, sig=1.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|dd",&obj, &sig, &rad))
         return NULL;
     
     if ((sig <= 0.0) || (rad < 0)) ERRMSG("Sigma and radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, SharpenImage(mag, rad, sig, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    opargs.sig = sig;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, sharpen_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(spread_op, SpreadImage(mag, a->n, exc))
+
 static char doc_spread_image[] = "out = spread(img, rad(3))\n\n"\
 " Create a special effect by randomly displacing each pixel in a block\n"\
 "   defined by the rad parameter.";
@@ -7788,33 +11240,40 @@ spread_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     int rad=3;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Oi",&obj, &rad))
         return NULL;
     
     if ((rad <= 0)) ERRMSG("Radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, SpreadImage(mag, rad, &exception));
-        CHECK_ERR;
-    }
+    opargs.n = rad;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, spread_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(unsharpmask_op,
+         UnsharpMaskImage(mag, a->rad, a->sig, a->x, a->y, exc))
+
 static char doc_unsharpmask_image[] = \
 "out = unsharpmask(img, sig{, rad, amount, thresh})\n\n"\
 " Sharpen an image using Unsharp Masking.\n\n"\
@@ -7829,11 +11288,13 @@ unsharpmask_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0, sig;
     double amount, thresh;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Od|ddd",&obj, &sig, &rad, &amount, &thresh))
         return NULL;
     
@@ -7843,24 +11304,30 @@ unsharpmask_image(PyObject *self, PyObject *args)
       ERRMSG("Threshold should be between 0.0 and 1.0");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, UnsharpMaskImage(mag, rad, sig, 
-                              amount, thresh, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    opargs.sig = sig;
+    opargs.x = amount;
+    opargs.y = thresh;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, unsharpmask_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL;
 }
 
 
+FRAME_OP(charcoal_op, CharcoalImage(mag, a->rad, a->sig, exc))
+
 static char doc_charcoal_image[] = "out = charcoal(img, sig(1.0), rad(0.0))\n\n"\
 " Create an edge-highlighted image.";
 static PyObject *
@@ -7868,10 +11335,12 @@ charcoal_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=0.0, sig=1.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|dd",&obj, &sig, &rad))
         return NULL;
     
@@ -7879,22 +11348,28 @@ charcoal_image(PyObject *self, PyObject *args)
     if ((sig <= 0.0) || (rad <= 0.0)) ERRMSG("Sigma and radius must be non-negative");
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, CharcoalImage(mag, rad, sig, &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    opargs.sig = sig;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, charcoal_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(colorize_op,
+         ColorizeImage(mag, (const char *) a->info, a->color, exc))
+
 static char doc_colorize_image[] = "out = colorize(img, color, {R, G, B})\n\n"\
 " Blends the color with each pixel in the image. A fraction blend is\n"\
 "   specified with R, G, and B.  Control the application of different color\n"\
@@ -7906,13 +11381,15 @@ colorize_image(PyObject *self, PyObject *args)
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
     PyObject *tcolor = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     PixelPacket target;
     double red=0.25, green, blue;
     int N;
     char opacity[MaxTextExtent];
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "OO|ddd",&obj, &tcolor, &red, &green, &blue))
         return NULL;
     
@@ -7929,24 +11406,28 @@ colorize_image(PyObject *self, PyObject *args)
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
     FormatString(opacity, "%g/%g/%g", red, green, blue);
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ColorizeImage(mag, opacity, target,
-                                                   &exception));
-        CHECK_ERR;
-    }
+    opargs.info = opacity;
+    opargs.color = target;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, colorize_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(convolve_op, ConvolveImage(mag, a->n, (const double *) a->info, exc))
+
 static char doc_convolve_image[] = "out = convolve(img, kernel)\n\n"\
 " Convolve the image with the arbitrary kernel.\n"\
 "   Kernel must be an NxN array where N is odd.";
@@ -7957,10 +11438,12 @@ convolve_image(PyObject *self, PyObject *args)
     PyObject *obj = NULL;
     PyObject *kernel = NULL;
     PyObject *arrkrn = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     int order;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "OO", &obj, &kernel))
         return NULL;
     
@@ -7972,20 +11455,21 @@ convolve_image(PyObject *self, PyObject *args)
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, 
-                          ConvolveImage(mag, order, (double *)DATA(arrkrn),
-                                        &exception));
-        CHECK_ERR;
-    }
+    opargs.n = order;
+    opargs.info = DATA(arrkrn);
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, convolve_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
     Py_DECREF(arrkrn);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     Py_XDECREF(arrkrn);
@@ -7993,6 +11477,8 @@ convolve_image(PyObject *self, PyObject *args)
 }
 
 
+FRAME_OP(implode_op, ImplodeImage(mag, a->x, exc))
+
 static char doc_implode_image[] = "out = implode(img, amount(0.50))\n\n"\
 " Implode image pixels by the specified factor.";
 static PyObject *
@@ -8000,26 +11486,30 @@ implode_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double amount=0.50;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|d",&obj, &amount))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, ImplodeImage(mag, amount,  &exception));
-        CHECK_ERR;
-    }
+    opargs.x = amount;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, implode_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -8037,27 +11527,35 @@ morph_images(PyObject *self, PyObject *args)
     PyObject *obj = NULL;
     PyMImageObject *new=NULL;
     long frames;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Ol", &obj, &frames))
         return NULL;
     if (frames < 0) ERRMSG("number of frames must be > 0");
 
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = MorphImages(ASIM(imobj)->ims, frames, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = MorphImages(ASIM(imobj)->ims, frames, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+FRAME_OP(oilpaint_op, OilPaintImage(mag, a->rad, exc))
+
 static char doc_oilpaint_image[] = "out = oilpaint(img, rad(3.0))\n\n"\
 " Apply a special effect filter that simulates an oil painting.\n"\
 "   Each pixel is replaced by the most frequent color occurring in\n"\
@@ -8067,26 +11565,30 @@ oilpaint_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double rad=3.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|d",&obj, &rad))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, OilPaintImage(mag, rad,  &exception));
-        CHECK_ERR;
-    }
+    opargs.rad = rad;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, oilpaint_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -8104,26 +11606,37 @@ stegano_image(PyObject *self, PyObject *args)
     PyObject *imark = NULL;
     Image *mag;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc, frame;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "OO",&obj, &mark))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
     if ((imark = mimage_from_object(mark))==NULL) goto fail;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
     new->ims = NewImageList();
+    /* Every frame reads the watermark, so this one stays serial */
+    Py_BEGIN_ALLOW_THREADS
     for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, SteganoImage(mag, ASIM(imark)->ims,
-                                                  &exception));
-        CHECK_ERR;
-    }
+        GetExceptionInfo(&frame);
+        AppendImageToList(&new->ims, SteganoImage(mag, ASIM(imark)->ims,
+                                                  &frame));
+        keep_exception(&exc, &frame);
+        DestroyExceptionInfo(&frame);
+        if (MAGICK_FAILED(exc)) break;
+    }
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
     Py_DECREF(imark);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     Py_XDECREF(imark);
@@ -8146,14 +11659,16 @@ stereo_image(PyObject *self, PyObject *args)
     Image *ima, *imb;
     PyMImageObject *new=NULL;
     int Na, Nb;
+    ExceptionInfo exc, frame;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "OO",&obja, &objb))
         return NULL;
     
     if ((imga = mimage_from_object(obja))==NULL) return NULL;
     if ((imgb = mimage_from_object(objb))==NULL) goto fail;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
     new->ims = NewImageList();
     imb = ASIM(imgb)->ims;
@@ -8161,21 +11676,31 @@ stereo_image(PyObject *self, PyObject *args)
     Na = GetImageListLength(ima);
     Nb = GetImageListLength(imb);
     if (Na != Nb) ERRMSG("Both image sequences must have the same length");
+    Py_BEGIN_ALLOW_THREADS
     for ( ; ima && imb; ima=ima->next, imb=imb->next) {
-    AppendImageToList(&new->ims, StereoImage(ima, imb, &exception));
-        CHECK_ERR;
-    }
+        GetExceptionInfo(&frame);
+        AppendImageToList(&new->ims, StereoImage(ima, imb, &frame));
+        keep_exception(&exc, &frame);
+        DestroyExceptionInfo(&frame);
+        if (MAGICK_FAILED(exc)) break;
+    }
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imga);
     Py_DECREF(imgb);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imga);
     Py_XDECREF(imgb);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(swirl_op, SwirlImage(mag, a->x, exc))
+
 static char doc_swirl_image[] = "out = swirl(img, deg)\n\n"\
 " Swirl the pixels about the center of the image.\n"\
 "   The parameter deg indicates the angle of the arc through which each\n"\
@@ -8186,31 +11711,37 @@ swirl_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double deg;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Od",&obj, &deg))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, SwirlImage(mag, deg,  &exception));
-        CHECK_ERR;
-    }
+    opargs.x = deg;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, swirl_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(wave_op, WaveImage(mag, a->x, a->y, exc))
+
 static char doc_wave_image[] = "out = wave(img, amp(25.0), length(15.0))\n\n"\
 " Create a 'ripple' effect in the image by shifting the pixels\n"\
 "   vertically along a sine wave whose amplitude and wavelength is\n"\
@@ -8220,31 +11751,38 @@ wave_image(PyObject *self, PyObject *args)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     double amp=25.0, length=15.0;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|dd",&obj, &amp, &length))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, WaveImage(mag, amp, length, &exception));
-        CHECK_ERR;
-    }
+    opargs.x = amp;
+    opargs.y = length;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, wave_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
+FRAME_OP(border_op, BorderImage(mag, (const RectangleInfo *) a->info, exc))
+
 static char doc_border_image[] = \
 "out = border(img, width, height, bordercolor=)\n\n"\
 " Surround the image with a border of the color defined by the\n"\
@@ -8257,11 +11795,13 @@ border_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     int width, height;
     RectangleInfo border_info;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "Oii",&obj, &width, &height))
         return NULL;
       
@@ -8280,24 +11820,35 @@ border_image(PyObject *self, PyObject *args, PyObject *kwds)
     }
     border_info.width = width;
     border_info.height = height;
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-    AppendImageToList(&new->ims, BorderImage(mag, &border_info, 
-                                                 &exception));
-        CHECK_ERR;
-    }
+    opargs.info = &border_info;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, border_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
 }
 
 
+static Image *
+frame_op(const Image *mag, const FrameArgs *a, ExceptionInfo *exc)
+{
+    FrameInfo frame_info = *(const FrameInfo *) a->info;
+
+    frame_info.width = 2*a->columns + mag->columns;
+    frame_info.height = 2*a->rows + mag->rows;
+    return FrameImage(mag, &frame_info, exc);
+}
+
 static char doc_frame_image[] = \
 "out = frame(img, width(25), height(25), inner(6), outer(6), mattecolor=)\n\n"\
 " Add a simulated three-dimensional border around the image.  The color\n"\
@@ -8312,12 +11863,14 @@ frame_image(PyObject *self, PyObject *args, PyObject *kwds)
 {
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
-    Image *mag;
     PyMImageObject *new=NULL;
     int width=25, height=25;
     int inner=6, outer=6;
     FrameInfo frame_info;
+    FrameArgs opargs;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|iiii",&obj, &width, &height, &inner, 
                           &outer)) return NULL;
       
@@ -8341,20 +11894,21 @@ frame_image(PyObject *self, PyObject *args, PyObject *kwds)
     frame_info.outer_bevel = outer;
     frame_info.x = width;
     frame_info.y = height;    
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = NewImageList();
-    for (mag=ASIM(imobj)->ims; mag; mag=mag->next) {
-        frame_info.width = 2*width + mag->columns;
-        frame_info.height = 2*height + mag->rows;
-    AppendImageToList(&new->ims, FrameImage(mag, &frame_info, 
-                                                 &exception));
-        CHECK_ERR;
-    }
+    opargs.columns = width;
+    opargs.rows = height;
+    opargs.info = &frame_info;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = filter_frames(ASIM(imobj)->ims, frame_op, &opargs, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -8370,20 +11924,26 @@ append_image(PyObject *self, PyObject *args)
     PyObject *obj = NULL;
     PyMImageObject *new=NULL;
     int stack=0;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O|i",&obj, &stack))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = AppendImages(ASIM(imobj)->ims, stack, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = AppendImages(ASIM(imobj)->ims, stack, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -8399,20 +11959,26 @@ average_image(PyObject *self, PyObject *args)
     PyObject *imobj = NULL;
     PyObject *obj = NULL;
     PyMImageObject *new=NULL;
+    ExceptionInfo exc;
 
+    GetExceptionInfo(&exc);
     if (!PyArg_ParseTuple(args, "O",&obj))
         return NULL;
     
     if ((imobj = mimage_from_object(obj))==NULL) return NULL;
 
-    new = PyObject_New(PyMImageObject, &MImage_Type);
+    new = mimage_alloc();
     if (new == NULL) goto fail;
-    new->ims = AverageImages(ASIM(imobj)->ims, &exception);
-    CHECK_ERR;
+    Py_BEGIN_ALLOW_THREADS
+    new->ims = AverageImages(ASIM(imobj)->ims, &exc);
+    Py_END_ALLOW_THREADS
+    CHECK_EXC(exc);
     Py_DECREF(imobj);
+    DestroyExceptionInfo(&exc);
     return (PyObject *)new;
 
  fail:
+    DestroyExceptionInfo(&exc);
     Py_XDECREF(imobj);
     Py_XDECREF(new);
     return NULL; 
@@ -8432,7 +11998,9 @@ listcolors(PyObject *self, PyObject *args)
 {
     PyObject *fileobj=NULL;
     FILE *fid;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (!PyArg_ParseTuple(args, "|O", &fileobj)) return NULL;
     
     if (fileobj==NULL) fid = stdout;
@@ -8458,7 +12026,9 @@ name2color(PyObject *self, PyObject *args)
 {
     char *name;
     PixelPacket color;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (!PyArg_ParseTuple(args, "s", &name)) return NULL;
 
     if (!QueryColorDatabase(name, &color, &exception))
@@ -8486,7 +12056,9 @@ color2name(PyObject *self, PyObject *args)
     char imdata[] = {0};
     Image *im=NULL;
     ComplianceType comp;
-    
+    ExceptionInfo exception;
+
+    GetExceptionInfo(&exception);
     if (!PyArg_ParseTuple(args, "O|s", &tcolor, &standard)) return NULL;
     if (standard == NULL) 
         comp = XPMCompliance;
@@ -8516,9 +12088,64 @@ color2name(PyObject *self, PyObject *args)
 /* Think about changing all METH_VARARGS to add KEYWORDS which set
    attributes of image before application of method */
 
+static char doc_pixelkernel[] = "name = pixelkernel(<name>)\n\n"\
+" Return the name of the kernel used to copy pixels into arrays by\n"\
+"   toarray() and getpixels().  If name is given ('scalar', 'ssse3' or\n"\
+"   'avx2') select that kernel first; it must be supported by the CPU.";
+static PyObject *
+pixelkernel(PyObject *self, PyObject *args)
+{
+    char *name = NULL;
+    int k;
+
+    if (!PyArg_ParseTuple(args, "|s", &name)) return NULL;
+    if (name != NULL) {
+        for (k=0; kernelnames[k]; k++)
+            if (strcmp(name, kernelnames[k]) == 0) break;
+        if (kernelnames[k] == NULL) {
+            PyErr_Format(PyMagickError, "Unknown pixel kernel: %s", name);
+            return NULL;
+        }
+        if (!kernel_supported(k)) {
+            PyErr_Format(PyMagickError, "Pixel kernel %s is not supported "
+                         "on this machine.", name);
+            return NULL;
+        }
+        _kernel = k;
+    }
+    return PyString_FromString(kernelnames[_kernel]);
+}
+
+static char doc_workers[] = "n = workers(<n>)\n\n"\
+" Return the number of threads used to convert between arrays and\n"\
+"   images.  If n is given (1 to 64) use that many first.  Each frame\n"\
+"   is split into bands of rows; the result does not depend on n.";
+static PyObject *
+workers(PyObject *self, PyObject *args)
+{
+    int n = 0;
+
+    if (!PyArg_ParseTuple(args, "|i", &n)) return NULL;
+    if (n != 0) {
+        if ((n < 1) || (n > MAX_WORKERS)) {
+            PyErr_Format(PyExc_ValueError, "Number of workers must be "
+                         "between 1 and %d.", MAX_WORKERS);
+            return NULL;
+        }
+        _workers = n;
+    }
+    return PyInt_FromLong(_workers);
+}
+
+
 static PyMethodDef magick_methods[] = {
     {"image", (PyCFunction)magick_new_image, METH_VARARGS|METH_KEYWORDS,
      doc_image},
+    {"stream", (PyCFunction)magick_stream, METH_VARARGS|METH_KEYWORDS,
+     doc_stream},
+    {"ping", (PyCFunction)magick_ping, METH_VARARGS|METH_KEYWORDS,
+     doc_ping},
+    {"lazy", (PyCFunction)magick_lazy, METH_O, doc_lazy},
     {"newdc", (PyCFunction)magick_new_draw, METH_VARARGS|METH_KEYWORDS, 
      "Create a new drawing context with IM-loaded defaults."},
     {"average", (PyCFunction)average_image, METH_VARARGS, doc_average_image},
@@ -8582,6 +12209,13 @@ static PyMethodDef magick_methods[] = {
 #endif
     {"name2color", (PyCFunction)name2color, METH_VARARGS, doc_name2color},
     {"color2name", (PyCFunction)color2name, METH_VARARGS, doc_color2name},
+    {"pixelkernel", (PyCFunction)pixelkernel, METH_VARARGS, doc_pixelkernel},
+    {"workers", (PyCFunction)workers, METH_VARARGS, doc_workers},
+    {"frameworkers", (PyCFunction)frameworkers, METH_VARARGS, 
+     doc_frameworkers},
+    {"imagecache", (PyCFunction)imagecache, METH_VARARGS, doc_imagecache},
+    {"stats", (PyCFunction)magick_stats, METH_VARARGS|METH_KEYWORDS, 
+     doc_stats},
     {NULL, NULL, 0, NULL}
 };
 
@@ -8593,16 +12227,19 @@ initmagick(void)
     char str[2] = {0, 0};
     PyArray_Descr *descr;
     Quantum mRGB=MaxRGB;
+    int i;
 
     MImage_Type.ob_type = &PyType_Type;
+    Blob_Type.ob_type = &PyType_Type;
+    Pipeline_Type.ob_type = &PyType_Type;
+    Drawing_Type.ob_type = &PyType_Type;
     import_array()
         
+#ifdef HAVE_MAGICK_ALLOC_FUNCTIONS
+    MagickAllocFunctions(count_free, count_malloc, count_realloc);
+#endif
     InitializeMagick("MImage");
 
-    GetExceptionInfo(&exception);
-    SetWarningHandler(PyMagickErrorHandler);
-    SetErrorHandler(PyMagickErrorHandler);
-    SetFatalErrorHandler(PyMagickErrorHandler);
 
     _qsize = sizeof(Quantum);
     if (_qsize == 1) ptype = PyArray_UBYTE;
@@ -8611,6 +12248,20 @@ initmagick(void)
     else {
         fprintf(stderr, "Unknown Quantum Depth in ImageMagick Library.");
     }
+    _rgbstride = (int) offsetof(PixelPacket, green) - 
+        (int) offsetof(PixelPacket, red);
+    if (((int) offsetof(PixelPacket, blue) - 
+         (int) offsetof(PixelPacket, green)) != _rgbstride)
+        _rgbstride = 0;
+    _pixelorder[offsetof(PixelPacket, red)/_qsize] = 'R';
+    _pixelorder[offsetof(PixelPacket, green)/_qsize] = 'G';
+    _pixelorder[offsetof(PixelPacket, blue)/_qsize] = 'B';
+    _pixelorder[offsetof(PixelPacket, opacity)/_qsize] = 'A';
+#ifdef HAVE_X86_KERNELS
+    build_shuffle_masks();
+#endif
+    for (_kernel = NumberOf(kernelfuncs)-1; _kernel > 0; _kernel--)
+        if (kernel_supported(_kernel)) break;
     
     m = Py_InitModule("magick", magick_methods);
     d = PyModule_GetDict(m);
@@ -8635,6 +12286,15 @@ initmagick(void)
         Py_DECREF(aint);
     }
     PyDict_SetItemString(d, "mimagetype", (PyObject *)&MImage_Type);
+    aint = PyString_FromString(_pixelorder);
+    PyDict_SetItemString(d, "pixelorder", aint);
+    Py_DECREF(aint);
+    aint = PyTuple_New(NumberOf(ColorspaceTypes)-1);
+    for (i=0; ColorspaceTypes[i]; i++)
+        PyTuple_SET_ITEM(aint, i, PyString_FromString(ColorspaceTypes[i]));
+    PyDict_SetItemString(d, "colorspaces", aint);
+    Py_DECREF(aint);
+    stats_init(d, magick_methods, image_methods);
 
     if (PyErr_Occurred()) {
         Py_FatalError ("Cannot initialize module _magick");
@@ -24,12 +24,22 @@ for directory in output.split(' '):
     if directory.startswith('-I'):
         include_dirs.append(directory[2:])
 
+# MagickAllocFunctions (used by magick.stats) appeared in 1.2
+define_macros = []
+gmversion = commands.getoutput('GraphicsMagick-config --version').strip()
+try:
+    if tuple([int(x) for x in gmversion.split('.')[:2]]) >= (1, 2):
+        define_macros.append(('HAVE_MAGICK_ALLOC_FUNCTIONS', '1'))
+except ValueError:
+    pass
+
 setup(name = "magick",
       version = "0.7",
       ext_modules = [Extension("magick", ["imageobject.c"],
                                libraries=libraries,
                                library_dirs=library_dirs,
-                               include_dirs=include_dirs)],
+                               include_dirs=include_dirs,
+                               define_macros=define_macros)],
       description = "C-based Python Interface to GraphicsMagick",
       long_description = """Long description will be added soon""",
       author = "Christian Klein",
@@ -0,0 +1,74 @@
+# Regression checks for the magick module.
+#
+#   python tests.py
+
+import magick
+import Numeric
+
+def sequence(frames, rows=8, cols=10):
+    """Grayscale sequence with frames frames."""
+    a = Numeric.zeros((frames, rows, cols), 'b')
+    for k in range(frames):
+        a[k] = k
+    return magick.image(a)
+
+def test_repeat():
+    img = sequence(2)
+    for n in (0, 1, 2, 3, 5):
+        assert len(img * n) == n * len(img), (n, len(img * n))
+        cpy = img.copy()
+        cpy *= n
+        assert len(cpy) == n * len(img), (n, len(cpy))
+
+def test_setpixels_keeps_opacity():
+    rows, cols = 6, 5
+    rgba = Numeric.zeros((rows, cols, 4), 'b')
+    rgba[:,:,3] = (Numeric.arange(cols) * 40).astype('b')
+    img = magick.image(rgba)
+    red, alpha = 0, 3       # getpixels() returns red, green, blue, opacity
+    before = img.getpixels(0, 0, cols, rows)
+    rgb = Numeric.zeros((rows, cols, 3), 'b')
+    rgb[:,:,0] = 200
+    img.setpixels(rgb)
+    after = img.getpixels(0, 0, cols, rows)
+    assert Numeric.alltrue(Numeric.ravel(after[:,:,alpha] ==
+                                         before[:,:,alpha]))
+    assert Numeric.alltrue(Numeric.ravel(after[:,:,red] != 0))
+
+def kernels():
+    """Every pixel kernel this machine supports."""
+    names = []
+    for name in ('scalar', 'ssse3', 'avx2'):
+        try:
+            magick.pixelkernel(name)
+        except magick.error:
+            continue
+        names.append(name)
+    return names
+
+def test_getpixels_matches_toarray():
+    rows, cols = 7, 37
+    saved = magick.pixelkernel()
+    try:
+        for channels in (3, 4):
+            a = Numeric.zeros((rows, cols, channels), 'b')
+            for c in range(channels):
+                v = (Numeric.arange(rows*cols) * (c + 3) + 11 * c) % 251
+                a[:,:,c] = Numeric.reshape(v, (rows, cols)).astype('b')
+            img = magick.image(a)
+            for name in kernels():
+                magick.pixelkernel(name)
+                got = img.getpixels(0, 0, cols, rows)
+                want = img.toarray()
+                assert got.shape == want.shape, (name, got.shape)
+                assert Numeric.alltrue(Numeric.ravel(got == want)), name
+    finally:
+        magick.pixelkernel(saved)
+
+TESTS = [test_repeat, test_setpixels_keeps_opacity,
+         test_getpixels_matches_toarray]
+
+if __name__ == "__main__":
+    for test in TESTS:
+        test()
+        print "%-30s ok" % test.__name__